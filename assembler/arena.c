@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "util.h"
+
+#define BLOCKSIZE 65536
+
+/* Every allocation starts at a multiple of this */
+#define ALIGNMENT 8
+
+struct arena_block {
+    arena_block *next;
+    size_t size;
+
+    /* Keeps 'data' aligned */
+    union {
+        char data[1];
+        uint64_t align;
+    };
+};
+
+
+arena *arena_create() {
+    arena *a = calloc(1, sizeof(arena));
+
+    if (a == NULL)
+        error("Out of memory");
+
+    return a;
+}
+
+void arena_dispose(arena **a) {
+    arena_block *b = (*a)->blocks;
+
+    while (b != NULL) {
+        arena_block *next = b->next;
+
+        free(b);
+        b = next;
+    }
+
+    free(*a);
+    *a = NULL;
+}
+
+void *arena_alloc(arena *a, size_t size) {
+    arena_block *b;
+
+    size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+
+    if (size > a->free) {
+        /* Objects too big for a block get one of their own */
+        size_t bsize = (size > BLOCKSIZE) ? size : BLOCKSIZE;
+
+        if ((b = malloc(offsetof(arena_block, data) + bsize)) == NULL)
+            error("Out of memory");
+
+        b->size = bsize;
+
+        if ((size == bsize) && (a->blocks != NULL)) {
+            /* Keep handing out the rest of the current block */
+            b->next = a->blocks->next;
+            a->blocks->next = b;
+
+            return b->data;
+        }
+
+        b->next = a->blocks;
+        a->blocks = b;
+        a->free = bsize;
+    }
+
+    b = a->blocks;
+    a->free -= size;
+
+    return b->data + (b->size - a->free - size);
+}
+
+char *arena_strdup(arena *a, const char *s) {
+    size_t len = strlen(s) + 1;
+
+    return memcpy(arena_alloc(a, len), s, len);
+}
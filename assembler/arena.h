@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Region allocator for everything the assembler keeps while parsing.  Memory
+ * is handed out from large blocks and only ever released all at once, by
+ * arena_dispose().
+ */
+typedef struct arena_block arena_block;
+
+typedef struct {
+    arena_block *blocks;  /* Newest first */
+    size_t free;          /* Bytes left in the newest block */
+} arena;
+
+arena *arena_create();
+void arena_dispose(arena**);
+
+void *arena_alloc(arena*, size_t);
+char *arena_strdup(arena*, const char*);
+
+#endif
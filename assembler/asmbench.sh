@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Assembles generated sources of growing size and prints how long each one
+# took.  The lines per second should stay about the same for every size.
+# Run with "make bench".
+
+ASM=${1:-./assembler/dcpu16asm}
+TMP=${TMPDIR:-/tmp}/asmbench.$$
+
+trap 'rm -f $TMP.asm $TMP.hex' EXIT
+
+printf "%10s  %8s  %12s\n" "LINES" "SECONDS" "LINES/S"
+
+for lines in 125000 250000 500000 1000000; do
+    # A label, instructions referring to labels back and ahead, data and
+    # comments, starting over at address 0 now and then
+    awk -v n=$lines 'BEGIN {
+        for (i = 0; i < n / 8; i++) {
+            if (i % 1024 == 0)
+                print ".org 0"
+            printf ":l%d\n", i
+            printf "    SET A, l%d\n", (i * 7919) % (n / 8)
+            printf "    ADD [0x1000+I], 0x%x ; comment\n", i % 65536
+            printf "    IFE A, [l%d+B]\n", (i + 1) % (n / 8)
+            printf "    JSR l%d\n", i
+            print  "    .dat \"text\", 1, 2"
+            print  "; comment"
+            print  ""
+        }
+    }' > $TMP.asm
+
+    start=$(date +%s%N)
+    $ASM -o $TMP.hex $TMP.asm || exit 1
+    end=$(date +%s%N)
+
+    awk -v l=$lines -v ns=$((end - start)) 'BEGIN {
+        printf "%10d  %8.3f  %12d\n", l, ns / 1e9, l / (ns / 1e9)
+    }'
+done
@@ -26,68 +26,102 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "arena.h"
 #include "label.h"
 #include "parse.h"
+#include "optimize.h"
 #include "util.h"
 #include "dcpu16.h"
 #include "../common/linked_list.h"
 #include "../common/hexdump.h"
+#include "../common/image.h"
+#include "../common/object.h"
 
 /*
  * Maximum length of a label
  */
 #define MAXLABEL 64
 
-/*
- * RAM size (per specification
- */
-#define RAMSIZE 0x10000
-
-
 
 void display_help();
 void check_instruction(dcpu16instruction*);
 
-void write_memory(list*, list*);
+void settle_labels(dcpu16symtab*, dcpu16instruction*);
+void check_fixups(dcpu16symtab*);
+int write_extents(FILE*);
+int write_object_file(FILE*, dcpu16symtab*);
+void write_map(FILE*, dcpu16symtab*);
+void write_listing(FILE*, list*, dcpu16symtab*);
 
 /*
  * Options and output parameters
  */
 int flag_be = 0;
+int flag_binary = 0;
+int flag_raw = 0;
 int flag_paranoid = 0;
-list *labels;
-list *instructions;
-uint16_t ram[0x10000];
+int flag_optimize = 0;
+int flag_object = 0;
+dcpu16symtab *labels;
+uint16_t ram[RAMSIZE];
+
+/* The address and line of every instruction go here as they are assembled,
+ * if writing a map */
+static FILE *map = NULL;
+
+/* One bit per word of 'ram' written to by emit() */
+static uint32_t written[RAMSIZE / 32];
+
+/* Number of writes to every word of 'ram', so that fixups for words already
+ * overwritten by later code (after an .org or wrapping around) are dropped */
+static uint32_t writes[RAMSIZE];
+
+/* With "-c", the symbol every word was last set to the address of, for the
+ * relocations of the object.  Only valid while 'write' is the count of
+ * writes to the word. */
+static struct {
+    int symbol;
+    uint32_t write;
+} refs[RAMSIZE];
+
+/* With "-O", the labels defined at the PC since the last instruction, with
+ * their fixups kept to thread jumps to them if the next one is a jump */
+static dcpu16label **fresh = NULL;
+static int nfresh = 0, freshsize = 0;
 
 extern char *srcfile, *cur_line, *cur_pos;
 extern int curline;
 
-void free_label(void *d) {
-    dcpu16label *l = d;
-
-    free(l->label);
-    free(l);
-}
-
 int main(int argc, char **argv) {
     int lopts_index = 0;
-    char outfile[256] = "out.hex";
+    char outfile[256] = "";
+    const char *mapfile = NULL;
+    const char *listfile = NULL;
+    list *source = NULL;
 
     FILE *input = stdin;
     FILE *output = NULL;
 
-    labels = list_create();
-    instructions = list_create();
+    /* Everything kept while parsing, released at once at the end */
+    arena *memory = arena_create();
+
+    labels = symtab_create(memory);
 
     static struct option lopts[] = {
         {"bigendian", no_argument, NULL, 'b'},
+        {"binary",    no_argument, NULL, 'B'},
+        {"raw",       no_argument, NULL, 'r'},
         {"help",      no_argument, NULL, 'h'},
         {"paranoid",  no_argument, NULL, 'p'},
+        {"optimize",  no_argument, NULL, 'O'},
+        {"object",    no_argument, NULL, 'c'},
+        {"map",       required_argument, NULL, 'm'},
+        {"listing",   required_argument, NULL, 'l'},
         {NULL,        0,           NULL,  0 }
     };
 
     for (;;) {
-        int opt = getopt_long(argc, argv, "bho:p", lopts, &lopts_index);
+        int opt = getopt_long(argc, argv, "bBrho:pOcm:l:", lopts, &lopts_index);
 
         if (opt < 0)
             break;
@@ -100,6 +134,14 @@ int main(int argc, char **argv) {
             flag_be = 1;
             break;
 
+        case 'B':
+            flag_binary = 1;
+            break;
+
+        case 'r':
+            flag_binary = flag_raw = 1;
+            break;
+
         case 'h':
             display_help();
             return 0;
@@ -108,9 +150,26 @@ int main(int argc, char **argv) {
             flag_paranoid = 1;
             break;
 
+        case 'O':
+            flag_optimize = 1;
+            break;
+
+        case 'c':
+            flag_object = 1;
+            break;
+
         case 'o':
             strncpy(outfile, optarg, sizeof(outfile));
             break;
+
+        case 'm':
+            mapfile = optarg;
+            break;
+
+        case 'l':
+            listfile = optarg;
+            source = list_create();
+            break;
         }
     }
 
@@ -127,7 +186,10 @@ int main(int argc, char **argv) {
         }
     }
 
-    if ((output = fopen(outfile, "w+")) == NULL) {
+    if (!*outfile)
+        strcpy(outfile, flag_object ? "out.o" : "out.hex");
+
+    if ((output = fopen(outfile, flag_binary ? "wb+" : "w+")) == NULL) {
         fprintf(stderr, "Unable to open '%s' -- aborting\n", outfile);
 
         if (input != stdin)
@@ -136,18 +198,57 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    /* Parse the file, storing labels and instructions as we go */
-    parsefile(input, instructions, labels);
+    if (mapfile != NULL) {
+        if ((map = fopen(mapfile, "w")) == NULL) {
+            fprintf(stderr, "Unable to open '%s' -- aborting\n", mapfile);
+            return 1;
+        }
+
+        fprintf(map, "; %s\n", srcfile);
+    }
+
+    /* Parse the file, assembling instructions as we go */
+    parsefile(input, labels, source, memory);
 
     cur_line = cur_pos = NULL;
-    write_memory(instructions, labels);
+    settle_labels(labels, NULL);
+
+    /* Labels left undefined are imported from other objects */
+    if (!flag_object)
+        check_fixups(labels);
 
-    write_hexdump(output, flag_be ? BIGENDIAN : LITTLEENDIAN, ram, RAMSIZE);
+    if (flag_object)
+        write_object_file(output, labels);
+    else if (flag_binary)
+        write_image(output, flag_be ? BIGENDIAN : LITTLEENDIAN, ram, RAMSIZE,
+                    flag_raw ? 0 : IMAGE_HEADER);
+    else
+        write_extents(output);
     fclose(output);
 
+    if (map != NULL) {
+        write_map(map, labels);
+        fclose(map);
+    }
+
+    if (listfile != NULL) {
+        FILE *listing = fopen(listfile, "w");
+
+        if (listing == NULL) {
+            fprintf(stderr, "Unable to open '%s' -- aborting\n", listfile);
+            return 1;
+        }
+
+        write_listing(listing, source, labels);
+        fclose(listing);
+
+        list_dispose(&source, NULL);
+    }
+
     /* Release resources */
-    list_dispose(&labels, &free_label);
-    list_dispose(&instructions, &free);
+    free(fresh);
+    symtab_dispose(&labels);
+    arena_dispose(&memory);
 
     if (input != stdin)
         fclose(input);
@@ -161,10 +262,37 @@ void display_help() {
            "  -h, --help          Display this help\n"
            "  -b, --bigendian     Generate big endian code "
                                  "rather than little endian\n"
+           "  -B, --binary        Write a binary image, starting with a "
+                                 "header giving its\n"
+           "                      origin and length, instead of a "
+                                 "hexdump\n"
+           "  -r, --raw           Write a binary image without a header, "
+                                 "starting at\n"
+           "                      address 0\n"
            "  -p, --paranoid      Turn on warnings about non-fatal (but "
                                  "potentially harmful) problems\n"
+           "                      and report every change made by "
+                                 "\"--optimize\"\n"
+           "  -O, --optimize      Replace instructions by cheaper ones "
+                                 "doing the same, and\n"
+           "                      leave out those without effect\n"
+           "  -c, --object        Write a relocatable object for "
+                                 "dcpu16ld instead, with the\n"
+           "                      code before the first .org placed "
+                                 "by the linker and\n"
+           "                      undefined labels taken from other "
+                                 "objects\n"
            "  -o FILENAME         Write output to FILENAME instead of "
-                                 "\"out.bin\"\n"
+                                 "\"out.hex\" (\"out.o\" with\n"
+           "                      \"--object\")\n"
+           "  -m, --map FILENAME  Write the address and source line of "
+                                 "every instruction\n"
+           "                      and the address of every label to "
+                                 "FILENAME\n"
+           "  -l, --listing FILENAME\n"
+           "                      Write a listing with the words and "
+                                 "cycles of every\n"
+           "                      line to FILENAME\n"
            "\n"
            "FILENAME, if given, is the source file to read instructions from.\n"
            "Defaults to standard input if not given or filename is \"-\"\n");
@@ -183,7 +311,38 @@ uint16_t encode_opcode(dcpu16token t) {
     return 0;
 }
 
-uint16_t encode_value(list *labels, dcpu16operand *op, uint16_t *wop) {
+/*
+ * Returns the value of label 'id' to be stored at 'addr'.  If the label is
+ * not defined yet, the word is left for define_label() to fill in.
+ */
+static uint16_t label_value(dcpu16symtab *labels, int id, uint16_t addr,
+                            int jump) {
+    dcpu16label *l = SYMBOL(labels, id);
+    dcpu16fixup *f;
+
+    refs[addr].symbol = id;
+    refs[addr].write = writes[addr] + 1;
+
+    if (l->defined)
+        return l->pc;
+
+    f = new_fixup(labels);
+    f->addr = addr;
+    f->write = writes[addr] + 1;
+    f->line = curline;
+    f->jump = jump;
+    f->next = l->fixups;
+    l->fixups = f;
+
+    return 0;
+}
+
+/*
+ * Encodes operand 'op', its next word, if any, going to 'addr'.  'jump' is
+ * set if it is the target of "SET PC, label".
+ */
+uint16_t encode_value(dcpu16symtab *labels, dcpu16operand *op,
+                      uint16_t *wop, uint16_t addr, int jump) {
     if (op->type == REGISTER) {
         if (is_register(op->token))
             return (op->token - T_A) + (op->addressing == REFERENCE 
@@ -205,39 +364,13 @@ uint16_t encode_value(list *labels, dcpu16operand *op, uint16_t *wop) {
             return 0x1e;
         }
     } else if (op->type == LABEL) {
-        dcpu16label *l = getlabel(labels, op->label);
-        if ((l != NULL) && l->defined) {
-            dcpu16addressing a = op->addressing;
-            /*
-             * TODO: Short labels
-             */
-            *wop = l->pc;
-
-            /*
-             * The next line is a very ugly hack to force the assembler to
-             * write the resolved label into the next word even if it
-             * resolves to < 0x20. This is so it can later use the numerical
-             * when looking for warnings
-             */
-            op->addressing = REFERENCE;
-            op->type = LITERAL;
-            op->numeric = l->pc;
-
-            return (a == IMMEDIATE ? 0x1f : 0x1e);
-        } else {
-            error("Unresolved label '%s'", op->label);
-        }
+        /* Labels short enough were turned into literals by the parser */
+        *wop = label_value(labels, op->symbol, addr, jump);
+
+        return (op->addressing == IMMEDIATE ? 0x1f : 0x1e);
     } else {
         if (op->register_offset.type == LABEL) {
-            dcpu16label *l = getlabel(labels, op->register_offset.label);
-
-            if ((l != NULL) && l->defined) {
-                *wop = l->pc;
-                op->register_offset.type = LITERAL;
-                op->register_offset.offset = l->pc;
-            } else {
-                error("Unresolved label '%s'", op->register_offset.label);
-            }
+            *wop = label_value(labels, op->register_offset.symbol, addr, 0);
         } else {
             *wop = op->register_offset.offset;
         }
@@ -249,14 +382,18 @@ uint16_t encode_value(list *labels, dcpu16operand *op, uint16_t *wop) {
 }
 
 void encode(dcpu16instruction *i, uint16_t *wi, uint16_t *wa, uint16_t *wb,
-            list *labels) {
+            dcpu16symtab *labels) {
+    /* Where the next words of a and b go */
+    uint16_t at_a = i->pc + 1;
+    uint16_t at_b = at_a + uses_next_word(&(i->a));
+
     if (is_nonbasic_instruction(i->opcode))
         *wi = 0x00 | encode_opcode(i->opcode) << 4
-                   | encode_value(labels, &(i->a), wa) << 10;
+                   | encode_value(labels, &(i->a), wa, at_a, 0) << 10;
     else
         *wi = encode_opcode(i->opcode)
-            | encode_value(labels, &(i->a), wa) << 4
-            | encode_value(labels, &(i->b), wb) << 10;
+            | encode_value(labels, &(i->a), wa, at_a, 0) << 4
+            | encode_value(labels, &(i->b), wb, at_b, is_jump(i)) << 10;
 }
 
 void check_instruction(dcpu16instruction *instr) {
@@ -270,39 +407,451 @@ void check_instruction(dcpu16instruction *instr) {
                     " ignored upon execution but still use CPU cycles.");
 }
 
-void write_memory(list *instructions, list *labels) {
+/*
+ * Stores a word of code or data
+ */
+void emit(uint16_t addr, uint16_t word) {
+    ram[addr] = word;
+    written[addr / 32] |= 1u << (addr % 32);
+    writes[addr]++;
+}
+
+/*
+ * Finds the ranges of RAM from 'addr' on written to by emit()
+ */
+static int find_extents(memextent *extents, uint32_t addr) {
+    int n = 0;
+
+    while (addr < RAMSIZE) {
+        /* Skip whole words of the bitmap at a time */
+        if (!(addr % 32) && !written[addr / 32]) {
+            addr += 32;
+        } else if (!(written[addr / 32] & (1u << (addr % 32)))) {
+            addr++;
+        } else {
+            extents[n].start = addr;
+
+            while ((addr < RAMSIZE)
+                    && (written[addr / 32] & (1u << (addr % 32))))
+                addr++;
+
+            extents[n++].end = addr;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Writes the ranges of RAM written to by emit() as a hexdump
+ */
+int write_extents(FILE *f) {
+    static memextent extents[RAMSIZE / 2];
+    int n = find_extents(extents, 0);
+
+    return write_hexdump_extents(f, flag_be ? BIGENDIAN : LITTLEENDIAN, ram,
+                                 extents, n);
+}
+
+/*
+ * Writes the object for "-c": the relocatable section, the words written
+ * after it as absolute sections, every label defined as an export, and
+ * the labels still undefined as imports
+ */
+int write_object_file(FILE *f, dcpu16symtab *labels) {
+    static memextent extents[RAMSIZE / 2];
+    static objsection sections[RAMSIZE / 2 + 1];
+    static objreloc relocs[RAMSIZE];
+    char *imported = calloc(labels->count + 1, 1);
+    dcpu16object o;
+    int i, j, n, ret;
+
+    memset(&o, 0, sizeof(o));
+    o.sections = sections;
+    o.relocs = relocs;
+    o.exports = malloc((labels->count + 1) * sizeof(objsymbol));
+    o.imports = malloc((labels->count + 1) * sizeof(char*));
+
+    if ((imported == NULL) || (o.exports == NULL) || (o.imports == NULL))
+        error("Out of memory");
+
+    if (relocatable_length) {
+        sections[0].start = 0;
+        sections[0].length = relocatable_length;
+        sections[0].relocatable = 1;
+        sections[0].words = ram;
+        o.nsections++;
+    }
+
+    n = find_extents(extents, relocatable_length);
+
+    for (i = 0; i < n; ++i) {
+        objsection *s = &(sections[o.nsections++]);
+
+        s->start = extents[i].start;
+        s->length = extents[i].end - extents[i].start;
+        s->relocatable = 0;
+        s->words = ram + s->start;
+    }
+
+    /* Words set to labels not known until linking */
+    for (i = 0; i < o.nsections; ++i) {
+        for (j = 0; j < (int)sections[i].length; ++j) {
+            uint16_t addr = sections[i].start + j;
+            dcpu16label *l;
+
+            if (!refs[addr].write || (refs[addr].write != writes[addr]))
+                continue;
+
+            l = SYMBOL(labels, refs[addr].symbol);
+
+            if (l->defined && !l->relocatable)
+                continue;
+
+            relocs[o.nrelocs].addr = addr;
+            relocs[o.nrelocs++].symbol = l->defined ? NULL : l->label;
+
+            if (l->defined)
+                continue;
+
+            /* Whatever it was set to before the jump to it was threaded */
+            ram[addr] = 0;
+
+            if (!imported[refs[addr].symbol]) {
+                imported[refs[addr].symbol] = 1;
+                o.imports[o.nimports++] = l->label;
+            }
+        }
+    }
+
+    for (i = 0; i < labels->count; ++i) {
+        dcpu16label *l = SYMBOL(labels, i);
+
+        if (l->defined) {
+            o.exports[o.nexports].name = l->label;
+            o.exports[o.nexports].value = l->pc;
+            o.exports[o.nexports++].relocatable = l->relocatable;
+        }
+    }
+
+    ret = write_object(f, &o);
+
+    free(o.exports);
+    free(o.imports);
+    free(imported);
+
+    return ret;
+}
+
+/*
+ * Encodes instruction 'i' into RAM at its address
+ */
+void assemble(dcpu16instruction *i, dcpu16symtab *labels) {
     /*
      * Purposeful shadowing of the global 'pc'
      */
-    uint16_t pc;
+    uint16_t pc = i->pc;
+    uint16_t op, a = 0, b = 0;
 
-    list_node *n = NULL;
+    settle_labels(labels, i);
+    encode(i, &op, &a, &b, labels);
 
-    for (n = list_get_root(instructions); n != NULL; n = n->next) {
-        uint16_t op, a, b;
-        dcpu16instruction *i = n->data;
+    /*
+     * TODO: Endianness
+     */
+    emit(pc++, op);
+
+    if (uses_next_word(&(i->a))) {
+        emit(pc++, a);
+    }
+
+    if (!is_nonbasic_instruction(i->opcode))
+        if (uses_next_word(&(i->b)))
+            emit(pc++, b);
+
+    if (flag_paranoid == 1)
+        check_instruction(i);
+
+    if (map != NULL)
+        fprintf(map, "%04X %d\n", i->pc, i->line);
+}
+
+/*
+ * Defines label 'l' at 'pc' and fills in the words waiting for it
+ */
+void define_label(dcpu16symtab *labels, dcpu16label *l, uint16_t pc) {
+    dcpu16fixup *f;
+
+    l->pc = pc;
+    l->defined = 1;
+
+    for (f = l->fixups; f != NULL; f = f->next) {
+        if (writes[f->addr] == f->write) {
+            emit(f->addr, pc);
+            f->write = refs[f->addr].write = writes[f->addr];
+        }
+    }
+
+    if (!flag_optimize) {
+        release_fixups(labels, l);
+        return;
+    }
+
+    /* Labels at an earlier PC were followed by data, not an instruction */
+    if (nfresh && (fresh[0]->pc != pc))
+        settle_labels(labels, NULL);
+
+    if (nfresh == freshsize) {
+        freshsize = freshsize ? freshsize * 2 : 16;
+
+        if ((fresh = realloc(fresh, freshsize * sizeof(dcpu16label*))) == NULL)
+            error("Out of memory");
+    }
+
+    fresh[nfresh++] = l;
+}
+
+/*
+ * Points the jumps to label 'l' filled in by define_label() to the label
+ * 'target' instead
+ */
+static void thread_fixups(dcpu16symtab *labels, dcpu16label *l, int target) {
+    dcpu16label *t = SYMBOL(labels, target);
+    dcpu16fixup *f;
+
+    for (f = l->fixups; f != NULL; f = f->next) {
+        if (!f->jump || (writes[f->addr] != f->write))
+            continue;
+
+        optimized(f->line, "jump to '%s' into jump to '%s'", l->label,
+                  t->label);
+
+        refs[f->addr].symbol = target;
+
+        if (t->defined) {
+            emit(f->addr, t->pc);
+            refs[f->addr].write = writes[f->addr];
+        } else {
+            dcpu16fixup *g = new_fixup(labels);
+
+            *g = *f;
+            g->next = t->fixups;
+            t->fixups = g;
+        }
+    }
+}
+
+/*
+ * Releases the fixups of the labels defined since the last instruction,
+ * threading the jumps to them first if 'i', the instruction at them, is a
+ * jump itself.  'i' is NULL if there is none.
+ */
+void settle_labels(dcpu16symtab *labels, dcpu16instruction *i) {
+    int n;
 
-        /* For the error() command */
-        curline = i->line;
+    for (n = 0; n < nfresh; ++n) {
+        dcpu16label *l = fresh[n];
 
-        pc = i->pc;
-        encode(i, &op, &a, &b, labels);
+        if ((i != NULL) && (i->pc == l->pc) && is_jump(i)) {
+            int target = thread_jump(labels, i->b.symbol);
 
-        /*
-         * TODO: Endianness
-         */
-        ram[pc++] = op;
+            l->jump = i->b.symbol;
 
-        if (uses_next_word(&(i->a))) {
-            ram[pc++] = a;
+            if (SYMBOL(labels, target) != l)
+                thread_fixups(labels, l, target);
         }
 
-        if (!is_nonbasic_instruction(i->opcode))
-            if (uses_next_word(&(i->b)))
-                ram[pc++] = b;
+        release_fixups(labels, l);
+    }
+
+    nfresh = 0;
+}
+
+/*
+ * Fails on the first line referring to a label that was never defined
+ */
+void check_fixups(dcpu16symtab *labels) {
+    dcpu16label *first = NULL;
+    int i, line = 0;
+
+    for (i = 0; i < labels->count; ++i) {
+        dcpu16fixup *f;
+
+        for (f = SYMBOL(labels, i)->fixups; f != NULL; f = f->next) {
+            if ((first == NULL) || (f->line < line)) {
+                first = SYMBOL(labels, i);
+                line = f->line;
+            }
+        }
+    }
+
+    if (first != NULL) {
+        curline = line;
+        error("Unresolved label '%s'", first->label);
+    }
+}
+
+/*
+ * Finishes the map of addresses to source lines for the emulator's profiler:
+ *
+ *   ADDR LINE         for every instruction, written by assemble()
+ *   :LABEL ADDR LINE  for every label
+ */
+void write_map(FILE *f, dcpu16symtab *labels) {
+    int j;
+
+    for (j = 0; j < labels->count; ++j) {
+        dcpu16label *l = SYMBOL(labels, j);
 
-        if (flag_paranoid == 1)
-            check_instruction(i);
+        if (l->defined)
+            fprintf(f, ":%s %04X %d\n", l->label, l->pc, l->line);
     }
 }
 
+/*
+ * Cycles the emulator spends on the instruction at 'pc', 1 more for IF*s
+ * that skip.  Like in the emulator, this is the cycle the instruction is
+ * executed in plus its cost.
+ */
+int instruction_cycles(uint16_t pc) {
+    /* Indexed by opcode, JSR for the nonbasic one */
+    static const int base[16] = {
+        2, 1, 2, 2, 2, 3, 3, 2, 2, 1, 1, 1, 2, 2, 2, 2
+    };
+
+    uint16_t word = ram[pc++];
+    uint8_t fields[2];
+    int i, n = 2, cost = base[word & 0x000F];
+
+    fields[0] = (word & 0x03F0) >> 4;
+    fields[1] = (word & 0xFC00) >> 10;
+
+    /* Nonbasic: opcode = a, a = b */
+    if ((word & 0x000F) == 0) {
+        fields[0] = fields[1];
+        n = 1;
+    }
+
+    /* The emulator only charges for literals not fitting into the field */
+    for (i = 0; i < n; ++i) {
+        if (fields[i] == 0x1f)
+            cost += ram[pc++] > 0x1f;
+        else if (((fields[i] >= 0x10) && (fields[i] < 0x18))
+                 || (fields[i] == 0x1e))
+            cost++, pc++;
+    }
+
+    return 1 + cost;
+}
+
+static int is_conditional(uint16_t word) {
+    return (word & 0x000F) >= 0xC;
+}
+
+static int by_address(const void *a, const void *b) {
+    return (*(dcpu16label* const*)a)->pc - (*(dcpu16label* const*)b)->pc;
+}
+
+/* What the instructions below an address add up to */
+typedef struct {
+    int words;
+    int count;
+    int cycles;
+} totals;
+
+/*
+ * Writes every source line along with its address, words and cycles,
+ * followed by the totals of the code from each label up to the next one.
+ * IF*s are counted as not skipping.
+ */
+void write_listing(FILE *f, list *source, dcpu16symtab *labels) {
+    dcpu16label **sorted = malloc(labels->count * sizeof(dcpu16label*));
+    totals *below = calloc(RAMSIZE + 1, sizeof(totals));
+    list_node *n;
+    uint32_t addr;
+    int i, nlabels = 0;
+
+    fprintf(f, "; %s\n", srcfile);
+    fprintf(f, "%-4s  %-14s  %3s  %6s  %5s  %s\n",
+            "ADDR", "WORDS", "LEN", "CYCLES", "LINE", "SOURCE");
+
+    for (n = list_get_root(source); n != NULL; n = n->next) {
+        dcpu16sourceline *l = n->data;
+        char *text = l->text;
+
+        while (isspace(*text))
+            text++;
+
+        text[strcspn(text, "\r\n")] = '\0';
+
+        if (!l->length) {
+            fprintf(f, "%-4s  %-14s  %3s  %6s  %5d  %s\n",
+                    "", "", "", "", l->line, text);
+            continue;
+        }
+
+        if (l->instruction) {
+            below[l->pc + 1].words += l->length;
+            below[l->pc + 1].cycles += instruction_cycles(l->pc);
+            below[l->pc + 1].count++;
+        }
+
+        /* Three words per row, data continues on the following rows */
+        for (i = 0; i < l->length; i += 3) {
+            char words[16] = {0};
+            char cycles[16] = {0};
+            int j;
+
+            for (j = i; (j < l->length) && (j < i + 3); ++j)
+                sprintf(words + strlen(words), (j > i) ? " %04X" : "%04X",
+                        ram[(uint16_t)(l->pc + j)]);
+
+            if (i > 0) {
+                fprintf(f, "%04X  %s\n", (uint16_t)(l->pc + i), words);
+                continue;
+            }
+
+            if (l->instruction) {
+                int c = instruction_cycles(l->pc);
+
+                if (is_conditional(ram[l->pc]))
+                    snprintf(cycles, sizeof(cycles), "%d/%d", c, c + 1);
+                else
+                    snprintf(cycles, sizeof(cycles), "%d", c);
+            }
+
+            fprintf(f, "%04X  %-14s  %3d  %6s  %5d  %s\n", l->pc, words,
+                    l->length, cycles, l->line, text);
+        }
+    }
+
+    for (addr = 0; addr < RAMSIZE; ++addr) {
+        below[addr + 1].words += below[addr].words;
+        below[addr + 1].count += below[addr].count;
+        below[addr + 1].cycles += below[addr].cycles;
+    }
+
+    for (i = 0; i < labels->count; ++i)
+        if (SYMBOL(labels, i)->defined)
+            sorted[nlabels++] = SYMBOL(labels, i);
+
+    if (nlabels) {
+        qsort(sorted, nlabels, sizeof(dcpu16label*), by_address);
+
+        fprintf(f, "\n%-20s  %4s  %5s  %12s  %6s\n",
+                "LABEL", "ADDR", "WORDS", "INSTRUCTIONS", "CYCLES");
+    }
+
+    for (i = 0; i < nlabels; ++i) {
+        const totals *from = &(below[sorted[i]->pc]);
+        const totals *to = &(below[(i + 1 < nlabels) ? sorted[i + 1]->pc
+                                                      : RAMSIZE]);
+
+        fprintf(f, "%-20s  %04X  %5d  %12d  %6d\n", sorted[i]->label,
+                sorted[i]->pc, to->words - from->words,
+                to->count - from->count, to->cycles - from->cycles);
+    }
+
+    free(below);
+    free(sorted);
+}
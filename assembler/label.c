@@ -1,40 +1,177 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
+#include "label.h"
+#include "util.h"
 #include "../common/types.h"
-#include "../common/linked_list.h"
 
-dcpu16label *getlabel(list *labels, const char *label) {
-    list_node *node = NULL;
+#define INITIAL_BUCKETS 256
 
-    for (node = list_get_root(labels); node != NULL; node = node->next) {
-        dcpu16label *ptr = node->data;
 
-        if (!(strcmp(ptr->label, label)))
-            return ptr;
+/* FNV-1a */
+static uint32_t hash(const char *s) {
+    uint32_t h = 2166136261u;
+
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+
+    return h;
+}
+
+dcpu16symtab *symtab_create(arena *a) {
+    dcpu16symtab *t = calloc(1, sizeof(dcpu16symtab));
+
+    if ((t == NULL)
+            || ((t->buckets = calloc(INITIAL_BUCKETS, sizeof(int))) == NULL))
+        error("Out of memory");
+
+    t->mask = INITIAL_BUCKETS - 1;
+    t->arena = a;
+
+    return t;
+}
+
+/*
+ * The labels themselves go with the arena
+ */
+void symtab_dispose(dcpu16symtab **t) {
+    free((*t)->labels);
+    free((*t)->buckets);
+    free(*t);
+
+    *t = NULL;
+}
+
+/*
+ * Returns the bucket holding 'label', or the empty one it would go into
+ */
+static int *find(dcpu16symtab *t, const char *label, uint32_t h) {
+    uint32_t i = h & t->mask;
+
+    while (t->buckets[i]) {
+        dcpu16label *l = t->labels[t->buckets[i] - 1];
+
+        if ((l->hash == h) && !strcmp(l->label, label))
+            break;
+
+        i = (i + 1) & t->mask;
+    }
+
+    return &(t->buckets[i]);
+}
+
+/*
+ * Doubles the number of buckets, keeping them at most half full
+ */
+static void grow(dcpu16symtab *t) {
+    int *old = t->buckets;
+    uint32_t i, size = t->mask + 1;
+
+    if ((t->buckets = calloc(size * 2, sizeof(int))) == NULL)
+        error("Out of memory");
+
+    t->mask = size * 2 - 1;
+
+    for (i = 0; i < size; ++i) {
+        uint32_t j;
+
+        if (!old[i])
+            continue;
+
+        j = t->labels[old[i] - 1]->hash & t->mask;
+
+        while (t->buckets[j])
+            j = (j + 1) & t->mask;
+
+        t->buckets[j] = old[i];
     }
-    
-    return NULL;
+
+    free(old);
+}
+
+dcpu16label *getlabel(dcpu16symtab *t, const char *label) {
+    int *b = find(t, label, hash(label));
+
+    return *b ? t->labels[*b - 1] : NULL;
 }
 
-dcpu16label *getnewlabel(list *labels, const char *label) {
-    dcpu16label *ptr = getlabel(labels, label);
-    
-    if (ptr != NULL)
-        return ptr;
+/*
+ * Returns the number of 'label', creating it if it was not seen before
+ */
+int getsymbol(dcpu16symtab *t, const char *label) {
+    uint32_t h = hash(label);
+    int *b = find(t, label, h);
+    dcpu16label *ptr;
+
+    if (*b)
+        return *b - 1;
 
     /*
      * Label was not found, so we create it
      */
-    ptr = malloc(sizeof(dcpu16label));
-    ptr->label = malloc(strlen(label) * sizeof(char) + 1);
-    strcpy(ptr->label, label);
+    if (t->count == t->size) {
+        t->size = t->size ? t->size * 2 : 64;
+        t->labels = realloc(t->labels, t->size * sizeof(dcpu16label*));
+
+        if (t->labels == NULL)
+            error("Out of memory");
+    }
+
+    ptr = arena_alloc(t->arena, sizeof(dcpu16label));
+    ptr->label = arena_strdup(t->arena, label);
 
     ptr->pc = 0;
+    ptr->line = 0;
     ptr->defined = 0;
+    ptr->hash = h;
+    ptr->fixups = NULL;
+    ptr->jump = -1;
+    ptr->relocatable = 0;
+
+    t->labels[t->count] = ptr;
+    *b = ++t->count;
 
-    list_push_back(labels, ptr);
+    if ((uint32_t)t->count * 2 > t->mask)
+        grow(t);
 
-    return ptr;
+    return t->count - 1;
 }
 
+dcpu16label *getnewlabel(dcpu16symtab *t, const char *label) {
+    int id = getsymbol(t, label);
+
+    return t->labels[id];
+}
+
+/*
+ * Returns an unused fixup, preferring released ones so that only as many
+ * are allocated as are outstanding at once
+ */
+dcpu16fixup *new_fixup(dcpu16symtab *t) {
+    dcpu16fixup *f = t->spare;
+
+    if (f != NULL)
+        t->spare = f->next;
+    else
+        f = arena_alloc(t->arena, sizeof(dcpu16fixup));
+
+    return f;
+}
+
+/*
+ * Hands the fixups of 'l' back for reuse
+ */
+void release_fixups(dcpu16symtab *t, dcpu16label *l) {
+    dcpu16fixup *f = l->fixups;
+
+    if (f == NULL)
+        return;
+
+    while (f->next != NULL)
+        f = f->next;
+
+    f->next = t->spare;
+    t->spare = l->fixups;
+    l->fixups = NULL;
+}
@@ -1,10 +1,51 @@
 #ifndef LABEL_H
 #define LABEL_H
 
+#include <stdint.h>
+
+#include "arena.h"
 #include "../common/types.h"
-#include "../common/linked_list.h"
 
-dcpu16label *getnewlabel(list*, const char*);
-dcpu16label *getlabel(list*, const char*);
+/*
+ * A word to be set to the address of a label once it is defined
+ */
+typedef struct dcpu16fixup {
+    uint16_t addr;
+    uint32_t write;  /* Count of writes to 'addr' once the word is emitted */
+    int line;        /* Of the instruction referring to the label */
+    int jump;        /* Set if the word is the target of "SET PC, label" */
+
+    struct dcpu16fixup *next;
+} dcpu16fixup;
+
+/*
+ * All labels of a program, each defined or referenced label once.  Labels
+ * are numbered in the order they were first seen, and found by name through
+ * an open addressing hash table of those numbers.  Labels and fixups are
+ * allocated from 'arena'.
+ */
+typedef struct {
+    dcpu16label **labels;  /* By symbol number */
+    int count;
+    int size;
+
+    int *buckets;          /* Symbol number + 1, 0 if empty */
+    uint32_t mask;         /* Number of buckets - 1 */
+
+    arena *arena;
+    dcpu16fixup *spare;    /* Fixups released for reuse */
+} dcpu16symtab;
+
+#define SYMBOL(t, id) ((t)->labels[id])
+
+dcpu16symtab *symtab_create(arena*);
+void symtab_dispose(dcpu16symtab**);
+
+dcpu16fixup *new_fixup(dcpu16symtab*);
+void release_fixups(dcpu16symtab*, dcpu16label*);
+
+int getsymbol(dcpu16symtab*, const char*);
+dcpu16label *getnewlabel(dcpu16symtab*, const char*);
+dcpu16label *getlabel(dcpu16symtab*, const char*);
 
 #endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Measures how fast the assembler's lexer tokenizes source, in MB of source
+ * per second, without parsing or assembling it.  Run with "make bench".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "lexer.h"
+
+#define LINES  (1 << 20)
+#define ROUNDS 8
+
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * Appends a line, terminated by a newline and a '\0' as parsefile() leaves
+ * them
+ */
+static void line(FILE *f, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(f, fmt, args);
+    va_end(args);
+
+    fputs("\n", f);
+    fputc('\0', f);
+}
+
+/*
+ * Generates LINES lines of source like those of the assembler benchmark,
+ * with the comments already stripped
+ */
+static char *generate(size_t *size) {
+    char *text = NULL;
+    FILE *f = open_memstream(&text, size);
+    int i;
+
+    for (i = 0; i < LINES / 8; ++i) {
+        if (i % 1024 == 0)
+            line(f, ".org 0");
+
+        line(f, ":label_%d", i);
+        line(f, "    SET A, label_%d", (i * 7919) % (LINES / 8));
+        line(f, "    ADD [0x1000+I], 0x%x", i % 65536);
+        line(f, "    IFE PEEK, [label_%d+B]", (i + 1) % (LINES / 8));
+        line(f, "    JSR label_%d", i);
+        line(f, "    .dat \"text\", 1, 2");
+        line(f, "    set push, pc");
+        line(f, "");
+    }
+
+    fclose(f);
+
+    return text;
+}
+
+int main() {
+    size_t size;
+    char *text = generate(&size);
+    char *end = text + size;
+    unsigned long tokens = 0;
+    double start, elapsed;
+    int i;
+
+    srcfile = "<lexbench>";
+    start = now();
+
+    for (i = 0; i < ROUNDS; ++i) {
+        char *p = text;
+
+        for (curline = 1; p < end; ++curline) {
+            cur_line = cur_pos = p;
+
+            while (nexttoken() != T_NEWLINE)
+                tokens++;
+
+            /* Past the newline is the '\0' ending the line */
+            p = cur_pos + 1;
+            tokens++;
+        }
+    }
+
+    elapsed = now() - start;
+    free(text);
+
+    printf("lexer    %8lu bytes  %8.1f MB/s  %8.1f Mtokens/s\n",
+           (unsigned long)size, size * ROUNDS / elapsed / 1e6,
+           tokens / elapsed / 1e6);
+
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "util.h"
+#include "lexer.h"
+#include "../common/types.h"
+
+int curline = 0;
+char *cur_line = NULL;
+char *cur_pos  = NULL;
+char *srcfile  = "<stdin>";
+dcpu16tokenvalue cur_tok;
+
+static uint16_t parsenumeric();
+static dcpu16token parsestring();
+
+
+/*
+ * Keywords are looked up by their (at most 4) characters packed into a
+ * word, case folded, in a table hashed by multiplication.  The multiplier
+ * is chosen so that no two keywords share a slot.  Adding a keyword may
+ * require a new one.
+ */
+#define KEYWORD_BITS 6
+#define KEYWORD_MULT 0x6F18EE7Du
+
+#define KEYWORD_SLOT(k) ((uint32_t)((k) * KEYWORD_MULT) >> (32 - KEYWORD_BITS))
+
+/* Only letters are folded into upper case, as '_' or a digit never match
+ * a keyword anyway */
+#define FOLD(c) ((uint32_t)(unsigned char)(c) & ~0x20u)
+
+static const struct {
+    const char *name;
+    dcpu16token token;
+} keywordlist[] = {
+    {"A", T_A}, {"B", T_B}, {"C", T_C}, {"X", T_X},
+    {"Y", T_Y}, {"Z", T_Z}, {"I", T_I}, {"J", T_J},
+
+    {"POP", T_POP}, {"PEEK", T_PEEK}, {"PUSH", T_PUSH},
+    {"SP", T_SP}, {"PC", T_PC}, {"O", T_O},
+
+    {"SET", T_SET}, {"ADD", T_ADD}, {"SUB", T_SUB}, {"MUL", T_MUL},
+    {"DIV", T_DIV}, {"MOD", T_MOD}, {"SHL", T_SHL}, {"SHR", T_SHR},
+    {"AND", T_AND}, {"BOR", T_BOR}, {"XOR", T_XOR}, {"IFE", T_IFE},
+    {"IFN", T_IFN}, {"IFG", T_IFG}, {"IFB", T_IFB}, {"JSR", T_JSR},
+
+    /* Also valid with a leading '.' */
+    {"DAT", T_DAT}, {"ORG", T_ORG}
+};
+
+static struct {
+    uint32_t key;  /* 0 if the slot is empty */
+    dcpu16token token;
+    const char *name;
+} keywords[1 << KEYWORD_BITS];
+
+/*
+ * Packs the 'len' characters at 's' into a key, 0 if too long for one
+ */
+static uint32_t keyword_key(const char *s, int len) {
+    uint32_t key = 0;
+    int i;
+
+    if (len > 4)
+        return 0;
+
+    for (i = 0; i < len; ++i)
+        key |= FOLD(s[i]) << (8 * i);
+
+    return key;
+}
+
+static void keywords_init() {
+    size_t i;
+
+    for (i = 0; i < sizeof(keywordlist) / sizeof(keywordlist[0]); ++i) {
+        const char *name = keywordlist[i].name;
+        uint32_t key = keyword_key(name, strlen(name));
+        uint32_t slot = KEYWORD_SLOT(key);
+
+        if (keywords[slot].key != 0)
+            error("Keywords '%s' and '%s' share a slot -- change KEYWORD_MULT",
+                  name, keywords[slot].name);
+
+        keywords[slot].key = key;
+        keywords[slot].token = keywordlist[i].token;
+        keywords[slot].name = name;
+    }
+}
+
+/*
+ * Returns the token of keyword 's' of length 'len', or T_IDENTIFIER
+ */
+static dcpu16token keyword(const char *s, int len) {
+    uint32_t key = keyword_key(s, len);
+
+    if ((key != 0) && (keywords[KEYWORD_SLOT(key)].key == key))
+        return keywords[KEYWORD_SLOT(key)].token;
+
+    return T_IDENTIFIER;
+}
+
+static uint16_t parsenumeric() {
+    unsigned int num = 0;
+
+    if ((cur_pos[0] == '0') && (cur_pos[1] == 'x')) {
+        char *p = cur_pos + 2;
+
+        for (; isxdigit(*p); ++p)
+            num = (num << 4) | (isdigit(*p) ? *p - '0'
+                                            : (toupper(*p) - 'A' + 10));
+    } else if (isdigit(*cur_pos)) {
+        char *p = cur_pos;
+
+        for (; isdigit(*p); ++p)
+            num = num * 10 + (*p - '0');
+    } else {
+        error("Expected numeric, got '%s'", cur_pos);
+    }
+
+    while (isxdigit(*cur_pos) || (*cur_pos == 'x'))
+       cur_pos++;
+
+    if (num > 0xFFFF)
+        warning("Literal value %X too big (> 0xFFFF) -- will wrap around.",
+                num);
+
+    return num;
+}
+static dcpu16token parsestring() {
+    char chr = 0;
+    size_t i = 0;
+
+    while (*cur_pos != '\"') {
+        if (*cur_pos == '\0') {
+           error("Expected '\"', got EOL");
+        } else if (*cur_pos == '\\') {
+            switch (*++cur_pos) {
+            case '\"': chr = '\"'; break;
+            case '\\': chr = '\\'; break;
+            case '\t': chr = '\t'; break;
+            case '\r': chr = '\r'; break;
+            default: error("Unknown escape character '%c'", *cur_pos);
+            }
+
+            cur_pos++;
+        } else {
+            chr = *cur_pos++;
+        }
+
+        if (i >= (sizeof(cur_tok.string) - 1))
+            break;
+
+        cur_tok.string[i++] = chr;
+    }
+
+    cur_pos++;
+    cur_tok.string[i] = '\0';
+
+    return T_STRING;
+}
+
+/*
+ * Scans an identifier starting at 'cur_pos' and returns its length
+ */
+static int scan_identifier() {
+    char *start = cur_pos;
+
+    while (isalnum(*cur_pos) || (*cur_pos == '_'))
+        cur_pos++;
+
+    return cur_pos - start;
+}
+
+dcpu16token nexttoken() {
+    static int initialized = 0;
+    dcpu16token tok;
+    int length;
+
+    if (!initialized) {
+        keywords_init();
+        initialized = 1;
+    }
+
+    /* Skip all spaces TO the next token */
+    while (isspace(*cur_pos))
+        cur_pos++;
+
+    /* Test some operators */
+    switch (*cur_pos++) {
+    case '\0':
+    case '\n': return T_NEWLINE;
+    case ',': return T_COMMA;
+    case '[': return T_LBRACK;
+    case ']': return T_RBRACK;
+    case '+': return T_PLUS;
+    case ':': return T_COLON;
+    case '\"': return parsestring();
+    case '.':
+        /* Assembler pseudo instructions */
+        if (isalpha(*cur_pos)) {
+            length = scan_identifier();
+            tok = keyword(cur_pos - length, length);
+
+            if ((tok == T_ORG) || (tok == T_DAT))
+                return tok;
+
+            cur_pos -= length;
+        }
+
+        break;
+    default: break;
+    }
+
+    cur_pos--;
+
+    if (isalpha(*cur_pos)) {
+        /* Instruction, register or label */
+        length = scan_identifier();
+
+        if ((tok = keyword(cur_pos - length, length)) != T_IDENTIFIER)
+            return tok;
+
+        if (length == 1)
+            error("Expected 'A', 'B', 'C', 'X', 'Y', 'Z', 'I' or 'J', "
+                  "got '%c'", *(cur_pos - 1));
+
+        memcpy(cur_tok.string, cur_pos - length, length);
+        cur_tok.string[length] = '\0';
+
+        return T_IDENTIFIER;
+    } else if (isdigit(*cur_pos)) {
+        cur_tok.number = parsenumeric();
+
+        return T_NUMBER;
+    }
+
+    error("Unrecognized input '%c'", *cur_pos);
+    return T_NEWLINE;
+}
+
+char *toktostr(dcpu16token t) {
+    switch (t) {
+        case T_A: case T_B: case T_C: case T_X: case T_Y: case T_Z:
+        case T_I: case T_J:
+            return "register";
+        case T_IDENTIFIER:
+            return "label";
+        case T_NUMBER:
+            return "numeric";
+        case T_LBRACK:
+            return "'['";
+        case T_RBRACK:
+            return "']'";
+        case T_COLON:
+            return "':'";
+        case T_COMMA:
+            return "','";
+        case T_POP: case T_PUSH: case T_PEEK:
+            return "stack-operation";
+
+        case T_PC: case T_O: case T_SP:
+            return "status-register";
+
+        case T_NEWLINE:
+            return "EOL";
+
+        default:
+            return "unknown";
+    }
+}
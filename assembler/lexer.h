@@ -0,0 +1,24 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdint.h>
+
+#include "../common/types.h"
+
+
+typedef union {
+    /* This should be big enough for any token */
+    char string[1024];
+    uint16_t number;
+} dcpu16tokenvalue;
+
+extern dcpu16tokenvalue cur_tok;
+
+/* Position in the source, for error messages */
+extern int curline;
+extern char *cur_line, *cur_pos, *srcfile;
+
+dcpu16token nexttoken();
+char *toktostr(dcpu16token);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "optimize.h"
+#include "parse.h"
+#include "util.h"
+#include "../common/dcpu16.h"
+#include "../common/types.h"
+
+/* Jumps followed at most this far, in case they go round in circles */
+#define MAX_THREADING 16
+
+
+/*
+ * Reports a change made by the optimizer to 'line' if "--paranoid" is given
+ */
+void optimized(int line, const char *fmt, ...) {
+    char msg[256];
+    int saved = curline;
+    va_list args;
+
+    if (!flag_paranoid)
+        return;
+
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+
+    curline = line;
+    warning("Optimized: %s", msg);
+    curline = saved;
+}
+
+int is_conditional_instruction(dcpu16token t) {
+    return ((t >= T_IFE) && (t <= T_IFB));
+}
+
+/*
+ * Returns whether 'instr' is "SET PC, label"
+ */
+int is_jump(dcpu16instruction *instr) {
+    return (instr->opcode == T_SET)
+        && (instr->a.type == REGISTER) && (instr->a.addressing == IMMEDIATE)
+        && (instr->a.token == T_PC)
+        && (instr->b.type == LABEL) && (instr->b.addressing == IMMEDIATE);
+}
+
+/*
+ * Returns the label a jump to label 'symbol' ends up at, following the
+ * jumps at the labels
+ */
+int thread_jump(dcpu16symtab *labels, int symbol) {
+    int i;
+
+    for (i = 0; (i < MAX_THREADING) && (SYMBOL(labels, symbol)->jump >= 0)
+                && (SYMBOL(labels, symbol)->jump != symbol); ++i)
+        symbol = SYMBOL(labels, symbol)->jump;
+
+    return symbol;
+}
+
+/*
+ * Returns k if 'n' is 2^k, -1 otherwise
+ */
+static int log2_exact(int n) {
+    int k = 0;
+
+    if ((n <= 0) || (n & (n - 1)))
+        return -1;
+
+    while (n > 1)
+        n >>= 1, k++;
+
+    return k;
+}
+
+/*
+ * Returns whether operands 'a' and 'b' are the same register or memory
+ * location, and reading them has no side effects
+ */
+static int same_operand(dcpu16operand *a, dcpu16operand *b) {
+    if ((a->type != b->type) || (a->addressing != b->addressing))
+        return 0;
+
+    switch (a->type) {
+    case REGISTER:
+        return (a->token == b->token) && !is_stack_operation(a->token);
+
+    case LITERAL:
+        /* Only references, assigning to literals is ignored anyway */
+        return (a->addressing == REFERENCE) && (a->numeric == b->numeric);
+
+    case LABEL:
+        return (a->addressing == REFERENCE) && (a->symbol == b->symbol);
+
+    case REGISTER_OFFSET:
+        return (a->register_offset.type == b->register_offset.type)
+            && (a->register_offset.register_index
+                    == b->register_offset.register_index)
+            && ((a->register_offset.type == LABEL)
+                    ? (a->register_offset.symbol == b->register_offset.symbol)
+                    : (a->register_offset.offset
+                           == b->register_offset.offset));
+    }
+
+    return 0;
+}
+
+/*
+ * Rewrites 'instr' into a cheaper equivalent where one is known, following
+ * the cycle counts of the emulator.  'after_conditional' is set if 'instr'
+ * follows an IFx, so it must not be left out.  Returns 0 if the instruction
+ * can be left out altogether.
+ */
+int optimize(dcpu16instruction *instr, dcpu16symtab *labels,
+             int after_conditional) {
+    dcpu16operand *b = &(instr->b);
+    int k;
+
+    if (!flag_optimize)
+        return 1;
+
+    /* MUL, DIV and MOD by 2^k, setting O just the same */
+    if ((b->type == LITERAL) && (b->addressing == IMMEDIATE)
+            && ((k = log2_exact(b->numeric)) >= 0)) {
+        switch (instr->opcode) {
+        case T_MUL:
+            /* Only cheaper if 2^k needs a next word */
+            if (b->numeric > 0x1f) {
+                optimized(instr->line, "MUL by %d into SHL by %d",
+                          b->numeric, k);
+                instr->opcode = T_SHL;
+                b->numeric = k;
+            }
+            break;
+
+        case T_DIV:
+            optimized(instr->line, "DIV by %d into SHR by %d", b->numeric, k);
+            instr->opcode = T_SHR;
+            b->numeric = k;
+            break;
+
+        case T_MOD:
+            optimized(instr->line, "MOD by %d into AND with %d", b->numeric,
+                      b->numeric - 1);
+            instr->opcode = T_AND;
+            b->numeric--;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    /* Jumps to jumps already assembled go straight to where those lead */
+    if (is_jump(instr)) {
+        dcpu16label *from = SYMBOL(labels, b->symbol);
+        int target = thread_jump(labels, b->symbol);
+
+        if (target != b->symbol) {
+            optimized(instr->line, "jump to '%s' into jump to '%s'",
+                      from->label, SYMBOL(labels, target)->label);
+            b->symbol = target;
+        }
+    }
+
+    if (after_conditional)
+        return 1;
+
+    /* SET X, X */
+    if ((instr->opcode == T_SET) && same_operand(&(instr->a), b)) {
+        optimized(instr->line, "removed SET without effect");
+        return 0;
+    }
+
+    return 1;
+}
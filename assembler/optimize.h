@@ -0,0 +1,17 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "label.h"
+#include "../common/types.h"
+
+
+extern int flag_optimize;
+
+int optimize(dcpu16instruction*, dcpu16symtab*, int);
+int is_jump(dcpu16instruction*);
+int thread_jump(dcpu16symtab*, int);
+int is_conditional_instruction(dcpu16token);
+
+void optimized(int, const char*, ...);
+
+#endif
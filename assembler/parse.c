@@ -1,78 +1,402 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 
 #include "util.h"
 #include "label.h"
 #include "parse.h"
+#include "lexer.h"
+#include "optimize.h"
 #include "../common/linked_list.h"
 #include "../common/dcpu16.h"
 #include "../common/types.h"
 
-int curline = 0;
-char *cur_line = NULL;
-char *cur_pos  = NULL;
-char *srcfile  = "<stdin>";
+int parseline(dcpu16symtab*, int*);
+dcpu16operand parseoperand(dcpu16symtab*);
 
-void readfile(FILE *f, list *lines);
-void parseline(list*, list*);
-dcpu16operand parseoperand(list*);
+static void shorten(dcpu16operand*, dcpu16symtab*);
+static void open_window();
+static void flush_window(dcpu16symtab*);
 
-uint16_t parsenumeric();
-dcpu16token parsestring();
-dcpu16token parseregister(char r);
+int pc;
 
-dcpu16token nexttoken();
+/*
+ * With "-c", the code and data before the first .org go into the relocatable
+ * section of the object, at offsets from 0.  Labels defined there are marked
+ * relocatable and never encoded as short literals, since their address is
+ * not known until linking.
+ */
+static int relocating = 0;
+int relocatable_length = 0;
+
+/* Set if the last instruction placed was an IFx, so the next one must stay */
+static int last_conditional = 0;
+
+/*
+ * Label operands resolving to 0x00 - 0x1F are encoded as short literals.
+ * Only labels defined while the PC is below 0x20 can do so, so the lines
+ * placed there are held back in a window until no label following them can
+ * end up that low any more, and then relaxed: starting with every label
+ * operand short, those whose labels end up above 0x1F are given a next word
+ * and the labels after them moved up, until nothing changes.
+ *
+ * Labels of the window are marked defined as soon as they are seen, at
+ * their address with every label operand short, and are only given their
+ * final address (and their fixups filled in) once the window is flushed.
+ *
+ * With "-O", jumps to labels not defined yet open a window too, which is
+ * held open until the next instruction or data, so that jumps to the line
+ * right after them can be left out.
+ */
+typedef struct {
+    int line;
+    dcpu16sourceline *source;  /* Listing entry, if writing one */
+
+    int labels;                /* First label defined here in window.labels */
+    int nlabels;
+
+    int instruction;           /* Set if 'instr' holds an instruction */
+    dcpu16instruction instr;
+
+    int data;                  /* First .dat word in window.data */
+    int words;
+
+    uint16_t length;           /* Words the line takes so far */
+
+    int jump;                  /* Set if 'instr' may jump to the next line */
+    int dropped;               /* Set if it does, so it is left out */
+} windowline;
+
+static struct {
+    int open;
+    int hold;        /* Set while the last line placed may be left out */
+    uint16_t start;  /* Address of the first line */
+    int minpc;       /* PC following the window with label operands short */
+
+    windowline *lines;
+    int count, size;
+
+    dcpu16label **labels;
+    int nlabels, labelsize;
+
+    uint16_t *data;
+    int ndata, datasize;
+} window;
+
+/* Grows 'array' of 'size' elements, if full, to hold at least 'count' + 1 */
+#define RESERVE(array, count, size) do {                                  \
+    if ((count) == (size)) {                                              \
+        (size) = (size) ? (size) * 2 : 64;                                \
+                                                                          \
+        if (((array) = realloc((array), (size) * sizeof(*(array)))) == NULL) \
+            error("Out of memory");                                       \
+    }                                                                     \
+} while (0)
+
+
+/*
+ * Cuts off the comment, and the whitespace before it, from 'buffer'
+ */
+static void strip_comment(char *buffer) {
+    char *loc = NULL;
+
+    if ((loc = strstr(buffer, ";")) != NULL) {
+        *loc = '\n';
+
+        while (buffer < loc && isspace(*loc))
+            loc--;
+
+        *(++loc) = '\0';
+    }
+}
 
-char *toktostr(dcpu16token);
-int pc;
+/*
+ * Parses and assembles all of 'f' a line at a time, so only the labels and
+ * the words waiting for labels yet to be defined are kept around.  If
+ * 'source' is not NULL, a dcpu16sourceline for every line read is appended
+ * to it, allocated from 'memory'.
+ */
+void parsefile(FILE *f, dcpu16symtab *labels, list *source, arena *memory) {
+    /* 1024 characters should do */
+    char buffer[1024] = {0};
+
+    relocating = flag_object;
+
+    while (fgets(buffer, sizeof(buffer), f) != NULL) {
+        uint16_t start = pc;
+        int words, instruction = 0;
+
+        strip_comment(buffer);
+
+        cur_pos = cur_line = buffer;
+        curline++;
+
+        words = parseline(labels, &instruction);
+
+        if (relocating && (pc > RAMSIZE))
+            error("Relocatable section larger than %d words", RAMSIZE);
+
+        /* Placed after an .org, on addresses 0 up to the .org, or wrapped */
+        if (words && flag_object && !relocating && relocatable_length
+                && ((start < relocatable_length) || (start + words > RAMSIZE)))
+            error("Code or data after .org overlaps the relocatable section");
+
+        if (source != NULL) {
+            size_t length = strlen(buffer) + 1;
+            dcpu16sourceline *l = arena_alloc(memory,
+                                              sizeof(dcpu16sourceline)
+                                              + length);
+
+            memcpy(l->text, buffer, length);
+            l->line = curline;
+            l->pc = (words > 0) ? start : pc;
+            l->length = words;
+            l->instruction = instruction;
+
+            list_push_back(source, l);
+
+            /* Lines in the window get their final address once flushed */
+            if (window.open && window.count
+                    && (window.lines[window.count - 1].line == curline))
+                window.lines[window.count - 1].source = l;
+        }
+
+        if (window.open && (window.minpc > 0x1F) && !window.hold)
+            flush_window(labels);
+    }
+
+    if (window.open)
+        flush_window(labels);
 
+    if (relocating)
+        relocatable_length = pc;
+
+    free(window.lines);
+    free(window.labels);
+    free(window.data);
+}
+
+/*
+ * Returns the window's entry for the current line, adding it if needed
+ */
+static windowline *window_line() {
+    windowline *w;
+
+    if (window.count && (window.lines[window.count - 1].line == curline))
+        return &(window.lines[window.count - 1]);
+
+    RESERVE(window.lines, window.count, window.size);
+
+    w = &(window.lines[window.count++]);
+    memset(w, 0, sizeof(*w));
+
+    w->line = curline;
+    w->labels = window.nlabels;
+    w->data = window.ndata;
+
+    return w;
+}
+
+static void open_window() {
+    window.open = 1;
+    window.hold = 0;
+    window.start = window.minpc = pc;
+    window.count = window.nlabels = window.ndata = 0;
+}
+
+/*
+ * Places .dat word 'w' at the PC
+ */
+static void put_data(uint16_t w) {
+    if (window.open) {
+        windowline *line = window_line();
+
+        RESERVE(window.data, window.ndata, window.datasize);
+
+        window.data[window.ndata++] = w;
+        line->words++;
+        line->length++;
+        window.minpc++;
+        window.hold = 0;
+        pc++;
+    } else {
+        emit(pc++, w);
+    }
+}
+
+/*
+ * Returns whether label operand 'op' fits into its operand field with the
+ * label's current address
+ */
+static int is_short(dcpu16operand *op, dcpu16symtab *labels) {
+    dcpu16label *l;
+
+    if ((op->type != LABEL) || (op->addressing != IMMEDIATE))
+        return 0;
+
+    l = SYMBOL(labels, op->symbol);
+
+    return l->defined && !l->relocatable && (l->pc <= 0x1F);
+}
+
+/*
+ * Turns 'op' into a literal if it is a label operand short enough for one
+ */
+static void shorten(dcpu16operand *op, dcpu16symtab *labels) {
+    if (is_short(op, labels)) {
+        op->numeric = SYMBOL(labels, op->symbol)->pc;
+        op->type = LITERAL;
+    }
+}
+
+static int operand_length(dcpu16operand *op, dcpu16symtab *labels) {
+    return is_short(op, labels) ? 0 : uses_next_word(op);
+}
+
+/*
+ * The least 'op' can take, assuming any label resolves to 0x00 - 0x1F
+ */
+static int min_operand_length(dcpu16operand *op) {
+    if ((op->type == LABEL) && (op->addressing == IMMEDIATE))
+        return 0;
+
+    return uses_next_word(op);
+}
+
+/*
+ * Moves the labels of the window to where its lines end up and lengthens its
+ * label operands, until neither changes
+ */
+static void relax(dcpu16symtab *labels) {
+    int changed, i, j;
+
+    /* Jumps to a label defined before the next instruction or data */
+    for (i = 0; i < window.count; ++i) {
+        windowline *w = &(window.lines[i]);
+        dcpu16label *target;
+        int next;
+
+        if (!w->jump)
+            continue;
+
+        target = SYMBOL(labels, w->instr.b.symbol);
+
+        for (next = i + 1; next < window.count; ++next) {
+            windowline *n = &(window.lines[next]);
+
+            for (j = 0; j < n->nlabels; ++j)
+                if (window.labels[n->labels + j] == target)
+                    w->dropped = 1;
+
+            if (n->instruction || n->words)
+                break;
+        }
+
+        /* Nothing following it in the window, so the label is not either */
+        if (next == window.count)
+            w->dropped = 0;
+
+        if (w->dropped)
+            w->length = 0;
+    }
 
-void readfile(FILE *f, list *lines) {
     do {
-        /* 1024 characters should do */
-        char buffer[1024] = {0};
-        char *loc = NULL;
+        uint16_t addr = window.start;
+        changed = 0;
 
-        if (fgets(buffer, sizeof(buffer), f) != NULL) {
-            int n;
-            if ((loc = strstr(buffer, ";")) != NULL) {
-                *loc = '\n';
+        for (i = 0; i < window.count; ++i) {
+            windowline *w = &(window.lines[i]);
 
-                while (buffer < loc && isspace(*loc))
-                    loc--;
+            for (j = 0; j < w->nlabels; ++j)
+                window.labels[w->labels + j]->pc = addr;
 
-                *(++loc) = '\0';
-            }
+            if (w->instruction && !w->dropped) {
+                dcpu16instruction *instr = &(w->instr);
+                int length = 1 + operand_length(&(instr->a), labels);
 
-            n = strlen(buffer);
-            
-            char *line = malloc(n * sizeof(char) + 1);
-            memset(line, 0, n * sizeof(char) + 1);
-            memcpy(line, buffer, n * sizeof(char));
+                if (!is_nonbasic_instruction(instr->opcode))
+                    length += operand_length(&(instr->b), labels);
 
-            list_push_back(lines, line);
+                if (length != w->length) {
+                    w->length = length;
+                    changed = 1;
+                }
+            }
+
+            addr += w->length;
         }
-    } while (!feof(f));
+    } while (changed);
 }
 
-void parsefile(FILE *f, list *instructions, list *labels) {
-    list *lines = list_create();
-    list_node *n;
-    readfile(f, lines);
+/*
+ * Relaxes the window, then assembles it
+ */
+static void flush_window(dcpu16symtab *labels) {
+    int line = curline;
+    char *line_start = cur_line, *pos = cur_pos;
+    int i, j;
 
-    for (n = list_get_root(lines); n != NULL; n = n->next) {
-        cur_pos = cur_line = n->data;
-        curline++;
+    relax(labels);
+
+    for (i = 0; i < window.count; ++i) {
+        windowline *w = &(window.lines[i]);
 
-        parseline(instructions, labels);
+        if (w->instruction && !w->dropped) {
+            shorten(&(w->instr.a), labels);
+
+            if (!is_nonbasic_instruction(w->instr.opcode))
+                shorten(&(w->instr.b), labels);
+        }
     }
 
-    list_dispose(&lines, &free);
+    /* Labels further down are referred to like any other forward label, so
+     * that "--optimize" can thread jumps to them */
+    for (i = 0; i < window.nlabels; ++i)
+        window.labels[i]->defined = 0;
+
+    /* The lines are done with, so are their positions */
+    cur_line = cur_pos = NULL;
+    pc = window.start;
+
+    for (i = 0; i < window.count; ++i) {
+        windowline *w = &(window.lines[i]);
+
+        curline = w->line;
+
+        for (j = 0; j < w->nlabels; ++j)
+            define_label(labels, window.labels[w->labels + j], pc);
+
+        if (w->dropped)
+            optimized(w->line, "removed jump to the next line");
+
+        if (w->instruction && !w->dropped) {
+            w->instr.pc = pc;
+            assemble(&(w->instr), labels);
+        }
+
+        for (j = 0; j < w->words; ++j)
+            emit(pc + j, window.data[w->data + j]);
+
+        if (w->source != NULL) {
+            w->source->pc = pc;
+            w->source->length = w->length;
+        }
+
+        pc += w->length;
+    }
+
+    window.open = 0;
+
+    curline = line;
+    cur_line = line_start;
+    cur_pos = pos;
 }
 
-void parseline(list *instructions, list *labels) {
+/*
+ * Returns the number of words the line assembled to.  'instruction' is set
+ * if they are code.
+ */
+int parseline(dcpu16symtab *labels, int *instruction) {
 start:
     ;;
     dcpu16token tok = nexttoken();
@@ -86,15 +410,33 @@ start:
                 error("Redefinition of label '%s' (%04X -> %04X) forbidden",
                         l->label, l->pc, pc);
 
-            l->pc = pc;
-            l->defined = 1;
+            if (!window.open && (pc < 0x20) && !relocating)
+                open_window();
+
+            l->relocatable = relocating;
+            l->line = curline;
+
+            if (window.open) {
+                windowline *w = window_line();
+
+                RESERVE(window.labels, window.nlabels, window.labelsize);
+
+                window.labels[window.nlabels++] = l;
+                w->nlabels++;
+
+                l->pc = window.minpc;
+                l->defined = 1;
+            } else {
+                define_label(labels, l, pc);
+            }
 
             goto start;
         } else {
             error("Expected label, got %s", toktostr(tok));
         }
     } else if (is_instruction(tok)) {
-        dcpu16instruction instr, *newinstr;
+        dcpu16instruction instr = {0};
+        int jump;
 
         instr.opcode = tok;
         instr.a = parseoperand(labels);
@@ -111,17 +453,53 @@ start:
             error("Expected EOL, got %s", toktostr(tok));
 
         /*
-         * All tokens valid, store instructions, advance PC
+         * All tokens valid, assemble the instruction, advance PC
          */
-        newinstr = malloc(sizeof(dcpu16instruction));
-        memcpy(newinstr, &instr, sizeof(dcpu16instruction));
+        instr.pc = pc;
+        instr.line = curline;
+
+        if (!optimize(&instr, labels, last_conditional))
+            return 0;
+
+        *instruction = 1;
+
+        /* A jump ahead, possibly to the next line */
+        jump = flag_optimize && !last_conditional && is_jump(&instr)
+                    && !SYMBOL(labels, instr.b.symbol)->defined;
+
+        last_conditional = is_conditional_instruction(instr.opcode);
+
+        if (!window.open && (((pc < 0x20) && !relocating) || jump))
+            open_window();
+
+        if (window.open) {
+            windowline *w = window_line();
+
+            w->instruction = 1;
+            w->instr = instr;
+            w->jump = jump;
+            w->length = 1 + min_operand_length(&(instr.a));
+
+            if (!is_nonbasic_instruction(instr.opcode))
+                w->length += min_operand_length(&(instr.b));
+
+            /* The least it can end up as is nothing at all */
+            window.minpc += jump ? 0 : w->length;
+            window.hold = jump;
+
+            pc += instruction_length(&instr);
+            return instruction_length(&instr);
+        }
 
-        newinstr->pc = pc;
-        newinstr->line = curline;
+        shorten(&(instr.a), labels);
 
-        list_push_back(instructions, newinstr);
+        if (!is_nonbasic_instruction(instr.opcode))
+            shorten(&(instr.b), labels);
 
-        pc += instruction_length(newinstr);
+        assemble(&instr, labels);
+        pc += instruction_length(&instr);
+
+        return instruction_length(&instr);
 
     } else if (is_macro(tok)) {
         if (tok == T_ORG) {
@@ -132,31 +510,40 @@ start:
                             "overriden.");
                 }
 
+                if (window.open)
+                    flush_window(labels);
+
+                if (relocating) {
+                    relocatable_length = pc;
+                    relocating = 0;
+                }
+
                 pc = cur_tok.number;
+                last_conditional = 0;
             } else {
                 error("Expected numeric, got %s", toktostr(tok));
             }
         } else if (tok == T_DAT) {
-            /* All of the stuff we are about to read, neatly packed
-             * into words */
-            list_node *p = NULL;
-            list *data = list_create();
+            /* All of the stuff we are about to read, stored as words
+             * as we go */
+            int words = 0;
+
+            if (!window.open && (pc < 0x20) && !relocating)
+                open_window();
+
+            last_conditional = 0;
 
             do {
                 if ((tok = nexttoken()) == T_STRING) {
                     char *ptr = cur_tok.string;
 
                     while (*ptr != '\0') {
-                        uint16_t *dat = malloc(sizeof(uint16_t));
-                        *dat = *ptr++;
-
-                        list_push_back(data, dat);
+                        put_data(*ptr++);
+                        words++;
                     }
                 } else if (tok == T_NUMBER) {
-                    uint16_t *dat = malloc(sizeof(uint16_t));
-                    *dat = cur_tok.number;
-
-                    list_push_back(data, dat);
+                    put_data(cur_tok.number);
+                    words++;
                 } else {
                     error("Expected string or numeric, got %s", toktostr(tok));
                 }
@@ -169,23 +556,18 @@ start:
                     error("Expected ',' or EOL, got %s", toktostr(tok));
             } while (1);
 
-            /*
-            ram[pc++] = cur_tok.number;
-            */
-            for (p = list_get_root(data); p != NULL; p = p->next) {
-                ram[pc++] = *((uint16_t*)p->data);
-            }
-
-            list_dispose(&data, &free);
+            return words;
         }
     } else if (tok == T_NEWLINE) {
-        return;
+        return 0;
     } else {
         error("Expected label-definition or opcode, got %s", toktostr(tok));
     }
+
+    return 0;
 }
 
-dcpu16operand parseoperand(list *labels) {
+dcpu16operand parseoperand(dcpu16symtab *labels) {
     dcpu16operand op = {0};
     dcpu16token tok;
 
@@ -194,7 +576,7 @@ dcpu16operand parseoperand(list *labels) {
     if ((tok = nexttoken()) == T_IDENTIFIER) {
         /* label */
         op.type = LABEL;
-        op.label = getnewlabel(labels, cur_tok.string)->label;
+        op.symbol = getsymbol(labels, cur_tok.string);
     } else if (tok == T_NUMBER) {
         /* numeric */
         op.type = LITERAL;
@@ -227,7 +609,7 @@ dcpu16operand parseoperand(list *labels) {
         } else if (a == T_IDENTIFIER) {
             /* [label] */
             op.type = LABEL;
-            op.label = getnewlabel(labels, cur_tok.string)->label;
+            op.symbol = getsymbol(labels, cur_tok.string);
         } else {
             error("Expected numeric, register or label, got %s", toktostr(a));
         }
@@ -250,8 +632,8 @@ dcpu16operand parseoperand(list *labels) {
                 if (b == T_IDENTIFIER) {
                     op.register_offset.type = LABEL;
                     op.register_offset.register_index = a;
-                    op.register_offset.label =
-                        getnewlabel(labels, cur_tok.string)->label;
+                    op.register_offset.symbol =
+                        getsymbol(labels, cur_tok.string);
 
                 } else if (b == T_NUMBER) {
                     op.register_offset.type = LITERAL;
@@ -271,8 +653,8 @@ dcpu16operand parseoperand(list *labels) {
                         op.register_offset.offset = cur_tok.number;
                     } else {
                         op.register_offset.type = LABEL;
-                        op.register_offset.label =
-                            getnewlabel(labels, cur_tok.string)->label;
+                        op.register_offset.symbol =
+                            getsymbol(labels, cur_tok.string);
                     }
                 } else  {
                     error("Expected register, got %s", toktostr(b));
@@ -289,184 +671,3 @@ dcpu16operand parseoperand(list *labels) {
 
     return op;
 }
-
-uint16_t parsenumeric() {
-    unsigned int num;
-
-    if (!strncmp(cur_pos, "0x", 2))
-       sscanf(cur_pos, "0x%X", (unsigned int *)&num);
-    else if ((isdigit(*cur_pos)))
-       sscanf(cur_pos, "%d", (int *)&num);
-    else
-       error("Expected numeric, got '%s'", cur_pos);
-
-    while (isxdigit(*cur_pos) || (*cur_pos == 'x'))
-       cur_pos++;
-
-    if (num > 0xFFFF)
-        warning("Literal value %X too big (> 0xFFFF) -- will wrap around.",
-                num);
-
-    return num;
-}
-
-dcpu16token parsestring() {
-    char chr;
-    size_t i = 0;
-
-    while (*cur_pos != '\"') {
-        if (*cur_pos == '\0') {
-           error("Expected '\"', got EOL");
-        } else if (*cur_pos == '\\') {
-            switch (*++cur_pos) {
-            case '\"': chr = '\"'; break;
-            case '\\': chr = '\\'; break;
-            case '\t': chr = '\t'; break;
-            case '\r': chr = '\r'; break;
-            default: error("Unknown escape character '%c'", *cur_pos);
-            }
-
-            cur_pos++;
-        } else {
-            chr = *cur_pos++;
-        }
-
-        if (i >= (sizeof(cur_tok.string) - 1))
-            break;
-
-        cur_tok.string[i++] = chr;
-    }
-
-    cur_pos++;
-    cur_tok.string[i] = '\0';
-
-    return T_STRING;
-}
-
-dcpu16token parseregister(char reg) {
-    switch (toupper(reg)) {
-    case 'A': return T_A;
-    case 'B': return T_B;
-    case 'C': return T_C;
-    case 'X': return T_X;
-    case 'Y': return T_Y;
-    case 'Z': return T_Z;
-    case 'I': return T_I;
-    case 'J': return T_J;
-    default:
-        error("Expected 'A', 'B', 'C', 'X', 'Y', 'Z', 'I' or 'J', got '%c'",
-                reg);
-    }
-
-    /* Since this can't happen, just make the compiler shut up */
-    return 0xFF;
-}
-
-dcpu16token nexttoken() {
-#define return_(x) /*printf("%d:%s\n", curline, #x);*/ return x;
-    /* Skip all spaces TO the next token */
-    while (isspace(*cur_pos))
-        cur_pos++;
-
-    /* Test some operators */
-    switch (*cur_pos++) {
-    case '\0':
-    case '\n': return_(T_NEWLINE);
-    case ',': return_(T_COMMA);
-    case '[': return_(T_LBRACK);
-    case ']': return_(T_RBRACK);
-    case '+': return_(T_PLUS);
-    case ':': return_(T_COLON);
-    case '\"': return parsestring(&cur_pos);
-    default: break;
-    }
-
-    cur_pos--;
-
-#define TRY(i) if (!strncasecmp(cur_pos, #i, strlen(#i))) {     \
-    if (!isalnum(*(cur_pos + strlen(#i)))) {                    \
-        cur_pos += strlen(#i);                                  \
-        return_(T_ ## i);                                       \
-    }                                                           \
-}
-
-#define TRYM(i) if (!strncasecmp(cur_pos, "." #i, strlen(#i) + 1)) { \
-    cur_pos += strlen(#i) + 1;                                       \
-    return_(T_ ## i);                                                \
-}
-
-    /* Try assembler pseudo instructions */
-    TRYM(ORG); TRYM(DAT);
-
-    /* Try instructions */
-    TRY(SET); TRY(ADD); TRY(SUB); TRY(MUL); TRY(DIV); TRY(MOD); TRY(SHL);
-    TRY(SHR); TRY(AND); TRY(BOR); TRY(XOR); TRY(IFE); TRY(IFN); TRY(IFG);
-    TRY(IFB); TRY(JSR);
-
-    /* Compatibility for other assemblers */
-    TRY(DAT); TRY(ORG);
-
-    /* And some "special" registers */
-    TRY(POP); TRY(PEEK); TRY(PUSH); TRY(SP); TRY(PC); TRY(O);
-
-#undef TRY
-#undef TRYM
-
-    if (isalpha(*cur_pos)) {
-        int strlength = 0;
-
-        /* Register or label */
-        while (isalnum(*cur_pos) || (*cur_pos == '_')) {
-            cur_pos++;
-            strlength++;
-        }
-
-        if (strlength > 1) {
-            strncpy(cur_tok.string, cur_pos - strlength, strlength);
-            cur_tok.string[strlength] = '\0';
-
-            return_(T_IDENTIFIER);
-        } else {
-            return parseregister(*(cur_pos - strlength));
-        }
-    } else if (isdigit(*cur_pos)) {
-        cur_tok.number = parsenumeric();
-
-        return_(T_NUMBER);
-    }
-
-    error("Unrecognized input '%c'", *cur_pos);
-    return T_NEWLINE;
-#undef return_
-}
-
-char *toktostr(dcpu16token t) {
-    switch (t) {
-        case T_A: case T_B: case T_C: case T_X: case T_Y: case T_Z:
-        case T_I: case T_J:
-            return "register";
-        case T_IDENTIFIER:
-            return "label";
-        case T_NUMBER:
-            return "numeric";
-        case T_LBRACK:
-            return "'['";
-        case T_RBRACK:
-            return "']'";
-        case T_COLON:
-            return "':'";
-        case T_COMMA:
-            return "','";
-        case T_POP: case T_PUSH: case T_PEEK:
-            return "stack-operation";
-
-        case T_PC: case T_O: case T_SP:
-            return "status-register";
-
-        case T_NEWLINE:
-            return "EOL";
-
-        default:
-            return "unknown";
-    }
-}
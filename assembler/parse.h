@@ -6,20 +6,32 @@
 #include <stdint.h>
 #include <ctype.h>
 
+#include "label.h"
+#include "lexer.h"
 #include "../common/linked_list.h"
 
-
-union {
-    /* This should be big enough for any token */
-    char string[1024];
-    uint16_t number;
-} cur_tok;
+/*
+ * A line of source and what it assembled to
+ */
+typedef struct {
+    int line;
+    uint16_t pc;
+    uint16_t length;  /* Words of code or data, 0 if none */
+    int instruction;  /* Set if the words are code */
+    char text[];
+} dcpu16sourceline;
 
 
 extern int pc;
 extern int flag_paranoid;
+extern int flag_object;
+extern int relocatable_length;
 extern uint16_t ram[];
 
-void parsefile(FILE*f, list*, list*);
+void emit(uint16_t, uint16_t);
+void assemble(dcpu16instruction*, dcpu16symtab*);
+void define_label(dcpu16symtab*, dcpu16label*, uint16_t);
+
+void parsefile(FILE*f, dcpu16symtab*, list*, arena*);
 
 #endif
@@ -11,7 +11,8 @@ int uses_next_word(dcpu16operand *op) {
         return 1;
     } else if (op->type == LABEL) {
         /*
-         * TODO: Short label support
+         * The assembler turns labels resolving to 0x00 - 0x1F into literals
+         * where it can, see assembler/parse.c
          */
         return 1;
     } else {
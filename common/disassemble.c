@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Turns instruction words back into assembler source
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "disassemble.h"
+
+
+static const char *const opcodes[16] = {
+    NULL,  "SET", "ADD", "SUB", "MUL", "DIV", "MOD", "SHL",
+    "SHR", "AND", "BOR", "XOR", "IFE", "IFN", "IFG", "IFB"
+};
+
+static const char *const registers[8] = {
+    "A", "B", "C", "X", "Y", "Z", "I", "J"
+};
+
+static const char *const specials[6] = {
+    "POP", "PEEK", "PUSH", "SP", "PC", "O"
+};
+
+/*
+ * Formats operand 'field' into 'buf', consuming the next word from 'next'
+ * if it uses one
+ */
+static void operand(uint8_t field, const uint16_t **next, char *buf,
+                    size_t size) {
+    if (field < 0x08)
+        snprintf(buf, size, "%s", registers[field]);
+    else if (field < 0x10)
+        snprintf(buf, size, "[%s]", registers[field - 0x08]);
+    else if (field < 0x18)
+        snprintf(buf, size, "[0x%X+%s]", *(*next)++, registers[field - 0x10]);
+    else if (field < 0x1e)
+        snprintf(buf, size, "%s", specials[field - 0x18]);
+    else if (field == 0x1e)
+        snprintf(buf, size, "[0x%X]", *(*next)++);
+    else if (field == 0x1f)
+        snprintf(buf, size, "0x%X", *(*next)++);
+    else
+        snprintf(buf, size, "0x%X", field - 0x20);
+}
+
+/*
+ * Writes the instruction starting at words[0] to 'buf'.  Up to three words
+ * are read.  Returns the length of the instruction in words.
+ */
+int disassemble(const uint16_t *words, char *buf, size_t size) {
+    const uint16_t *next = words + 1;
+    uint8_t op = words[0] & 0x000F;
+    uint8_t fa = (words[0] & 0x03F0) >> 4;
+    uint8_t fb = (words[0] & 0xFC00) >> 10;
+    char a[16], b[16];
+
+    if (op == 0x0) {
+        if (fa != 0x01) {
+            snprintf(buf, size, "DAT 0x%X", words[0]);
+            return 1;
+        }
+
+        operand(fb, &next, a, sizeof(a));
+        snprintf(buf, size, "JSR %s", a);
+    } else {
+        operand(fa, &next, a, sizeof(a));
+        operand(fb, &next, b, sizeof(b));
+        snprintf(buf, size, "%s %s, %s", opcodes[op], a, b);
+    }
+
+    return next - words;
+}
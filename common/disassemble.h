@@ -0,0 +1,10 @@
+#ifndef DISASSEMBLE_H
+#define DISASSEMBLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+int disassemble(const uint16_t*, char*, size_t);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Measures how fast hexdumps are written and read, in MB of hexdump text per
+ * second.  Run with "make bench".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hexdump.h"
+#include "types.h"
+
+#define ROUNDS  200
+
+static uint16_t mem[RAMSIZE], check[RAMSIZE];
+
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * Times writing and reading 'mem' as a hexdump ROUNDS times
+ */
+static int bench(const char *name) {
+    char *text = NULL;
+    size_t size = 0;
+    double start, written, read;
+    FILE *f;
+    int i;
+
+    start = now();
+
+    for (i = 0; i < ROUNDS; ++i) {
+        free(text);
+        f = open_memstream(&text, &size);
+        write_hexdump(f, LITTLEENDIAN, mem, RAMSIZE);
+        fclose(f);
+    }
+
+    written = now() - start;
+    start = now();
+
+    for (i = 0; i < ROUNDS; ++i) {
+        f = fmemopen(text, size, "r");
+
+        if (read_hexdump(f, LITTLEENDIAN, check, RAMSIZE) < 0) {
+            fprintf(stderr, "%s: unable to read back -- aborting\n", name);
+            return -1;
+        }
+
+        fclose(f);
+    }
+
+    read = now() - start;
+    free(text);
+
+    if (memcmp(mem, check, sizeof(mem))) {
+        fprintf(stderr, "%s: read back differs -- aborting\n", name);
+        return -1;
+    }
+
+    printf("%-8s %8lu bytes  write %8.1f MB/s  read %8.1f MB/s\n", name,
+           (unsigned long)size, size * ROUNDS / written / 1e6,
+           size * ROUNDS / read / 1e6);
+
+    return 0;
+}
+
+int main() {
+    int i;
+
+    /* Every row different */
+    srand(1);
+    for (i = 0; i < RAMSIZE; ++i)
+        mem[i] = rand();
+
+    if (bench("random") < 0)
+        return 1;
+
+    /* A program followed by mostly empty RAM */
+    memset(mem + 0x1000, 0, sizeof(mem) - 0x1000 * sizeof(uint16_t));
+
+    for (i = 0; i < 64; ++i)
+        mem[rand() % RAMSIZE] = rand();
+
+    if (bench("sparse") < 0)
+        return 1;
+
+    return 0;
+}
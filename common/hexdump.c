@@ -2,161 +2,314 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <ctype.h>
-#include <stdarg.h>
 
 #include "hexdump.h"
 
+/*
+ * Hexdumps are read and written in blocks of this many bytes
+ */
+#define BLOCKSIZE 65536
 
-endianness_t get_endianness() {
-    union {
-        uint16_t i;
-        char b[2];
-    } bo = { 0xBEEF };
+/* Longest line write_hexdump() produces: "XXXXX: " and 8 "XXXX " */
+#define MAXLINE 64
 
-    return bo.b[0] == 1;
+/*
+ * Words are always printed most significant digit first, so little endian
+ * dumps show every word with its bytes swapped, regardless of the host.
+ */
+#define SWAPS(s) ((uint16_t)((((s) & 0xFF00) >> 8) | (((s) & 0x00FF) << 8)))
+
+static const char hexdigits[16] = "0123456789ABCDEF";
+
+/* Value + 1 of every hex digit, 0 for anything else */
+static const int8_t hexvalues[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+    ['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+#define HEXVALUE(c) (hexvalues[(unsigned char)(c)] - 1)
+#define IS_SPACE(c) (((c) == ' ') || (((c) >= '\t') && ((c) <= '\r')))
+
+
+static char *put_word(char *p, uint16_t w) {
+    p[0] = hexdigits[w >> 12];
+    p[1] = hexdigits[(w >> 8) & 0xF];
+    p[2] = hexdigits[(w >> 4) & 0xF];
+    p[3] = hexdigits[w & 0xF];
+
+    return p + 4;
 }
 
-uint16_t swaps(uint16_t s) {
-    return ((s & 0xFF00) >> 8) | ((s & 0x00FF) << 8);
+static char *put_offset(char *p, unsigned int offset) {
+    int shift = 12;
+
+    while ((offset >> shift) >> 4)
+        shift += 4;
+
+    for (; shift >= 0; shift -= 4)
+        *p++ = hexdigits[(offset >> shift) & 0xF];
+
+    *p++ = ':';
+    *p++ = ' ';
+
+    return p;
 }
 
-int write_hexdump(FILE *f, endianness_t dstend, uint16_t *mem, size_t msize) {
-    unsigned int i;
-    uint16_t last[8] = {0};
-    int skipping = 0;
+/*
+ * State of write_hexdump() carried from row to row
+ */
+typedef struct {
+    FILE *f;
+    char *buf;
+    char *p;
+    int swap;
+    int error;
 
-    for (i = 0; i < msize;) {
-        unsigned int j = i, g = 0, r = 1;
+    uint16_t last[8];
+} hexwriter;
 
-        /* Check if this row of words is the same as the last row */
-        for (g = 0; g < 8; ++g) {
-            r = r && (last[g] == mem[i + g]);
-        }
+static void flush(hexwriter *w) {
+    if (fwrite(w->buf, 1, w->p - w->buf, w->f) != (size_t)(w->p - w->buf))
+        w->error = 1;
+
+    w->p = w->buf;
+}
+
+/*
+ * Writes the rows of mem[start] up to mem[end].  Unless 'first' is set, the
+ * first row may be left out if it repeats the last one printed.
+ */
+static void write_rows(hexwriter *w, uint16_t *mem, size_t start, size_t end,
+                       int first) {
+    size_t i = start, n, j;
 
-        /* If yes, [continue] skip[ping] next line[s]*/
-        if (r) {
-            if (!skipping) {
-                fprintf(f, "*\n");
-                skipping = 1;
-            }
-
-            /* Make sure the last line is always displayed */
-            if (skipping && ((msize - i) <= 8)) {
-                skipping = 0;
-            } else {
+    while (i < end) {
+        n = ((end - i) < 8) ? (end - i) : 8;
+
+        if ((w->p - w->buf) > BLOCKSIZE - MAXLINE)
+            flush(w);
+
+        /*
+         * Rows repeating the last one printed are left out and marked with
+         * a single '*', but the last row is always printed
+         */
+        if (!first && !memcmp(w->last, mem + i, n * sizeof(uint16_t))) {
+            *w->p++ = '*';
+            *w->p++ = '\n';
+
+            while (((end - i) > 8)
+                    && !memcmp(w->last, mem + i, sizeof(w->last)))
                 i += 8;
-                continue;
-            }
+
+            n = ((end - i) < 8) ? (end - i) : 8;
         }
 
-        skipping = 0;
-        fprintf(f, "%04X: ", i);
-
-        for (i = i; i < j+8; ++i) {
-            if (i >= msize)
-                break;
-
-            /*
-             * No need to check for system endianness, because
-             * printf write the word out the same regardless of
-             * endianness, in big endian. Thus to get little endian
-             * we _always_ have to switch it around.
-             */
-            if (dstend == LITTLEENDIAN)
-                fprintf(f, "%04X ", swaps(mem[i]));
-            else
-                fprintf(f, "%04X ", mem[i]);
-
-            last[i % 8] = mem[i];
+        w->p = put_offset(w->p, i);
+
+        for (j = 0; j < n; ++j) {
+            w->last[j] = mem[i + j];
+            w->p = put_word(w->p, w->swap ? SWAPS(w->last[j]) : w->last[j]);
+            *w->p++ = ' ';
         }
 
-        fprintf(f, "\n");
+        *w->p++ = '\n';
+        i += n;
+        first = 0;
     }
+}
+
+/*
+ * Writes 'n' extents of 'mem', which must be in ascending order and must not
+ * overlap.  Addresses between them are left out altogether; read_hexdump()
+ * leaves them untouched.
+ */
+int write_hexdump_extents(FILE *f, endianness_t dstend, uint16_t *mem,
+                          const memextent *extents, int n) {
+    hexwriter w;
+    int i;
+
+    memset(&w, 0, sizeof(w));
+    w.f = f;
+    w.swap = (dstend == LITTLEENDIAN);
+
+    if ((w.buf = w.p = malloc(BLOCKSIZE)) == NULL)
+        return -1;
+
+    for (i = 0; i < n; ++i)
+        write_rows(&w, mem, extents[i].start, extents[i].end, 1);
+
+    flush(&w);
+    free(w.buf);
+
+    return w.error ? -1 : 0;
+}
+
+int write_hexdump(FILE *f, endianness_t dstend, uint16_t *mem, size_t msize) {
+    hexwriter w;
+
+    memset(&w, 0, sizeof(w));
+    w.f = f;
+    w.swap = (dstend == LITTLEENDIAN);
+
+    if ((w.buf = w.p = malloc(BLOCKSIZE)) == NULL)
+        return -1;
+
+    /* Even the first row is left out if it is all zeroes */
+    write_rows(&w, mem, 0, msize, 0);
+
+    flush(&w);
+    free(w.buf);
+
+    return w.error ? -1 : 0;
+}
+
+/*
+ * State of read_hexdump() carried from line to line
+ */
+typedef struct {
+    uint16_t *mem;
+    size_t memsize;
+    int swap;
+
+    int continue_last;  /* The last line was a '*' */
+    uint16_t last[8];
+    long lastoff;
+    size_t next;        /* Address following the last word read */
+} hexreader;
+
+/*
+ * Fills mem[from] up to mem[to] with copies of the last row
+ */
+static void repeat_last(hexreader *r, size_t from, size_t to) {
+    size_t done = (to - from < 8) ? (to - from) : 8;
+
+    memcpy(r->mem + from, r->last, done * sizeof(uint16_t));
+
+    /* Double the copied part until it is filled */
+    while (from + done < to) {
+        size_t n = (to - from - done < done) ? (to - from - done) : done;
+
+        memcpy(r->mem + from + done, r->mem + from, n * sizeof(uint16_t));
+        done += n;
+    }
+}
+
+/*
+ * Parses one line, terminated by '\0'
+ */
+static int read_line(hexreader *r, const char *p) {
+    size_t offset = 0;
+    unsigned int i;
+
+    if (*p == '*') {
+        /* Continuation from last line */
+        r->continue_last = 1;
+        return 0;
+    }
+
+    if (HEXVALUE(*p) < 0)
+        return 0;
+
+    /* OOOO: NNNN [NNNN...]{0 .. 7} */
+    for (; HEXVALUE(*p) >= 0; ++p) {
+        offset = (offset << 4) | HEXVALUE(*p);
+
+        if (offset > r->memsize)
+            return -1;
+    }
+
+    /* Rows may skip addresses, but not go back */
+    if (!r->continue_last && (offset < r->next))
+        return -1;
+
+    if (r->continue_last) {
+        r->continue_last = 0;
+
+        if ((long)offset > r->lastoff + 8)
+            repeat_last(r, r->lastoff + 8, offset);
+    }
+
+    r->lastoff = offset;
+
+    while (IS_SPACE(*p))
+        p++;
+
+    if (*p++ != ':')
+        return -1;
+
+    for (i = 0; i < 8; ++i) {
+        uint16_t n = 0;
+        int digits;
+
+        while (IS_SPACE(*p))
+            p++;
+
+        if (HEXVALUE(*p) < 0)
+            break;
+
+        if (offset + i >= r->memsize)
+            return -1;
+
+        for (digits = 0; (digits < 4) && (HEXVALUE(*p) >= 0); ++digits)
+            n = (n << 4) | HEXVALUE(*p++);
+
+        while (HEXVALUE(*p) >= 0)
+            p++;
+
+        if (r->swap)
+            n = SWAPS(n);
+
+        r->last[i] = n;
+        r->mem[offset + i] = n;
+    }
+
+    r->next = offset + i;
 
     return 0;
 }
 
 int read_hexdump(FILE *f, endianness_t srcend, uint16_t *mem, size_t memsize) {
-    char buffer[512] = {0};
-    char *p = buffer;
-
-    int continue_last = 0;
-    uint16_t last[8] = {0};
-    int lastoff = -8;
-
-#define SKIP(p) while (isspace(*p)) p++;
-#define SKIPX(p) while (isxdigit(*p)) p++;
-
-    while (!feof(f)) {
-        memset(buffer, 0, sizeof(buffer));
-        fgets(buffer, sizeof(buffer), f);
-        p = buffer;
-
-        if (*p == '*') {
-            /*
-             * Continuation from last line
-             */
-            continue_last = 1;
-        } else if (isxdigit(*p)) {
-            /*
-             * OOOO: NNNN [NNNN...]{0 .. 7}
-             */
-            int offset;
-            sscanf(buffer, "%x", &offset);
-
-            if (!continue_last && ((offset - lastoff) != 8)) {
-                return -1;
-            }
-
-            if (continue_last) {
-                int i = 0;
-                int off = lastoff + 8;
-                continue_last = 0;
-                
-                while ((off+i) < offset) {
-                    mem[off + i] = last[i % 8];
-                    ++i;
-                }
-            }
-
-            lastoff = offset;
-
-            SKIPX(p);
-            SKIP(p);
-            if (*p++ == ':') {
-                unsigned int i;
-
-                for (i = 0; i < 8; ++i) {
-                    SKIP(p);
-                    if (isxdigit(*p)) {
-                        unsigned int n;
-
-                        if ((offset + i) > memsize) {
-                            return -1;
-                        }
-
-                        sscanf(p, "%04X", &n);
-                        if (n > 0xFFFF) {
-                            exit(1);
-                        }
-
-                        if (srcend != get_endianness())
-                            n = swaps(n);
-
-                        last[i] = n;
-                        mem[offset + i] = n;
-
-                        SKIPX(p);
-                    } else {
-                        break;
-                    }
-                }
-            } else {
-                return -1;
-            }
+    char *buf = malloc(BLOCKSIZE + 1);
+    size_t len = 0;
+    int eof = 0, ret = 0;
+    hexreader r;
+
+    if (buf == NULL)
+        return -1;
+
+    memset(&r, 0, sizeof(r));
+    r.mem = mem;
+    r.memsize = memsize;
+    r.swap = (srcend == LITTLEENDIAN);
+    r.lastoff = -8;
+
+    while (!eof && (ret == 0)) {
+        char *line = buf, *end;
+
+        len += fread(buf + len, 1, BLOCKSIZE - len, f);
+        eof = (len < BLOCKSIZE);
+
+        while ((ret == 0)
+                && ((end = memchr(line, '\n', buf + len - line)) != NULL)) {
+            *end = '\0';
+            ret = read_line(&r, line);
+            line = end + 1;
+        }
+
+        len -= line - buf;
+
+        /* A last line without a newline, or one too long for the buffer */
+        if ((ret == 0) && (eof || (len == BLOCKSIZE)) && len) {
+            line[len] = '\0';
+            ret = read_line(&r, line);
+            len = 0;
         }
+
+        memmove(buf, line, len);
     }
-    
-    return 0;
+
+    free(buf);
+    return ret;
 }
@@ -6,7 +6,17 @@ typedef enum {
     LITTLEENDIAN
 } endianness_t;
 
+/*
+ * A range of addresses, from 'start' up to but not including 'end'
+ */
+typedef struct {
+    size_t start;
+    size_t end;
+} memextent;
+
 int write_hexdump(FILE *f, endianness_t, uint16_t*, size_t);
+int write_hexdump_extents(FILE *f, endianness_t, uint16_t*,
+                          const memextent*, int);
 int read_hexdump(FILE *f, endianness_t, uint16_t*, size_t);
 
 #endif
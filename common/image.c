@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Binary images: the words of RAM as they are, optionally preceded by an
+ * imageheader.  Unlike hexdumps, these are loaded with one mmap() and a copy
+ * (or byte swap) straight into RAM.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+
+
+static endianness_t host_endianness() {
+    union {
+        uint16_t i;
+        uint8_t b[2];
+    } bo = { 0x0102 };
+
+    return (bo.b[0] == 0x02) ? LITTLEENDIAN : BIGENDIAN;
+}
+
+/*
+ * Copies 'n' words from 'src', swapping their bytes if 'swap' is set
+ */
+static void copy_words(uint16_t *dst, const uint8_t *src, size_t n, int swap) {
+    size_t i;
+
+    memcpy(dst, src, n * sizeof(uint16_t));
+
+    if (swap)
+        for (i = 0; i < n; ++i)
+            dst[i] = __builtin_bswap16(dst[i]);
+}
+
+/*
+ * Writes the words of 'mem' as a binary image in byte order 'dstend'.  Zero
+ * words at the end are left out, and with IMAGE_HEADER at the start as well.
+ */
+int write_image(FILE *f, endianness_t dstend, uint16_t *mem, size_t msize,
+                int flags) {
+    size_t start = 0, end = msize, i;
+    int swap = (dstend != host_endianness());
+    uint16_t buf[256];
+
+    while ((end > 0) && !mem[end - 1])
+        end--;
+
+    if (flags & IMAGE_HEADER) {
+        imageheader h;
+
+        while ((start < end) && !mem[start])
+            start++;
+
+        memcpy(h.magic, IMAGE_MAGIC, 3);
+        h.magic[3] = (dstend == BIGENDIAN) ? 'B' : 'L';
+        h.origin = swap ? __builtin_bswap16(start) : start;
+        h.reserved = 0;
+        h.length = swap ? __builtin_bswap32(end - start) : (end - start);
+
+        if (fwrite(&h, sizeof(h), 1, f) != 1)
+            return -1;
+    }
+
+    for (i = start; i < end; i += sizeof(buf) / sizeof(*buf)) {
+        size_t n = end - i;
+
+        if (n > sizeof(buf) / sizeof(*buf))
+            n = sizeof(buf) / sizeof(*buf);
+
+        copy_words(buf, (const uint8_t*)(mem + i), n, swap);
+
+        if (fwrite(buf, sizeof(uint16_t), n, f) != n)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Tells if 'f', a file not read from yet, starts with an imageheader
+ */
+int is_image(FILE *f) {
+    char magic[4];
+    struct stat st;
+
+    if ((fstat(fileno(f), &st) < 0) || !S_ISREG(st.st_mode))
+        return 0;
+
+    if (pread(fileno(f), magic, sizeof(magic), 0) != sizeof(magic))
+        return 0;
+
+    return !memcmp(magic, IMAGE_MAGIC, 3)
+        && ((magic[3] == 'L') || (magic[3] == 'B'));
+}
+
+/*
+ * Reads all of 'f' into a buffer, for input that can not be mapped
+ */
+static uint8_t *slurp(FILE *f, size_t *size) {
+    uint8_t *buf = NULL, *p;
+    size_t n = 0, alloc = 0;
+
+    do {
+        if (n == alloc) {
+            alloc = alloc ? alloc * 2 : 65536;
+
+            if ((p = realloc(buf, alloc)) == NULL) {
+                free(buf);
+                return NULL;
+            }
+
+            buf = p;
+        }
+
+        n += fread(buf + n, 1, alloc - n, f);
+    } while (n == alloc);
+
+    *size = n;
+    return buf;
+}
+
+/*
+ * Loads binary image 'f' into 'mem'.  Images with a header go where it says
+ * and in the byte order it says, others to address 0 in byte order 'srcend'.
+ * 'f' must not have been read from yet.  Returns the number of words loaded,
+ * or -1.
+ */
+int read_image(FILE *f, endianness_t srcend, uint16_t *mem, size_t msize) {
+    const uint8_t *data;
+    void *map = MAP_FAILED;
+    uint8_t *buf = NULL;
+    size_t size = 0, origin = 0, length;
+    struct stat st;
+    int ret = -1;
+
+    if ((fstat(fileno(f), &st) == 0) && S_ISREG(st.st_mode) && st.st_size) {
+        size = st.st_size;
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        data = map;
+    }
+
+    if (map == MAP_FAILED) {
+        if ((buf = slurp(f, &size)) == NULL)
+            return -1;
+
+        data = buf;
+    }
+
+    length = size / sizeof(uint16_t);
+
+    if ((size >= sizeof(imageheader)) && !memcmp(data, IMAGE_MAGIC, 3)
+            && ((data[3] == 'L') || (data[3] == 'B'))) {
+        imageheader h;
+
+        memcpy(&h, data, sizeof(h));
+        srcend = (data[3] == 'B') ? BIGENDIAN : LITTLEENDIAN;
+
+        if (srcend != host_endianness()) {
+            h.origin = __builtin_bswap16(h.origin);
+            h.length = __builtin_bswap32(h.length);
+        }
+
+        origin = h.origin;
+        length = h.length;
+        data += sizeof(h);
+        size -= sizeof(h);
+
+        if (length > size / sizeof(uint16_t))
+            goto out;
+    }
+
+    if (origin + length > msize)
+        goto out;
+
+    copy_words(mem + origin, data, length, srcend != host_endianness());
+    ret = length;
+
+out:
+    if (map != MAP_FAILED)
+        munmap(map, st.st_size);
+
+    free(buf);
+    return ret;
+}
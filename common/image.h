@@ -0,0 +1,30 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "hexdump.h"
+
+/* "D16L" or "D16B", depending on the byte order of the words */
+#define IMAGE_MAGIC "D16"
+
+/*
+ * Optional start of a binary image, in the byte order of its words.  Without
+ * it, an image is loaded at address 0.
+ */
+typedef struct {
+    char magic[4];
+    uint16_t origin;  /* Address of the first word */
+    uint16_t reserved;
+    uint32_t length;  /* Number of words following the header */
+} imageheader;
+
+/* write_image() flags */
+#define IMAGE_HEADER 0x0001
+
+int write_image(FILE*, endianness_t, uint16_t*, size_t, int);
+int is_image(FILE*);
+int read_image(FILE*, endianness_t, uint16_t*, size_t);
+
+#endif
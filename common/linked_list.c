@@ -22,18 +22,54 @@
 
 #include "linked_list.h"
 
+/* Nodes in the first chunk, each following chunk is twice as large */
+#define FIRST_CHUNK 16
+
+struct list_chunk {
+    list_chunk *next;
+    size_t size;
+
+    list_node nodes[];
+};
+
 
 linked_list *list_create() {
     linked_list *list = malloc(sizeof(linked_list));
 
-    if (list) {
-        list->root = NULL;
-        list->length = 0;
-    }
+    if (list)
+        memset(list, 0, sizeof(linked_list));
 
     return list;
 }
 
+/*
+ * Returns a cleared node from the list's newest chunk, allocating a new
+ * chunk if that one is used up
+ */
+static list_node *new_node(linked_list *list) {
+    list_node *node;
+
+    if (!list->free_nodes) {
+        size_t size = list->chunks ? list->chunks->size * 2 : FIRST_CHUNK;
+        list_chunk *chunk = malloc(sizeof(list_chunk)
+                                   + size * sizeof(list_node));
+
+        if (chunk == NULL)
+            return NULL;
+
+        chunk->next = list->chunks;
+        chunk->size = size;
+
+        list->chunks = chunk;
+        list->free_nodes = size;
+    }
+
+    node = &(list->chunks->nodes[list->chunks->size - list->free_nodes--]);
+    memset(node, 0, sizeof(*node));
+
+    return node;
+}
+
 list_node *list_get_root(linked_list *list) {
     if (list)
         return list->root;
@@ -47,19 +83,20 @@ list_node *list_push_front(linked_list *list, void *data) {
     if (list == NULL)
         return NULL;
 
-    tmp = malloc(sizeof(list_node));
+    tmp = new_node(list);
     if (tmp) {
         list_node *root = list_get_root(list);
 
-        memset(tmp, 0, sizeof(*tmp));
         tmp->data = data;
 
         if (root) {
             list->root = tmp;
             tmp->next = root;
         } else {
-            list->root = tmp;
+            list->root = list->tail = tmp;
         }
+
+        list->length++;
     }
 
     return tmp;
@@ -83,26 +120,37 @@ list_node *list_insert_before(linked_list *list, list_node *pos, void *data) {
             return NULL;
     }
 
-    tmp = malloc(sizeof(list_node));
+    tmp = new_node(list);
     if (tmp) {
-        memset(tmp, 0, sizeof(*tmp));
-
         tmp->data = data;
         tmp->next = pos;
         pre->next = tmp;
+
+        list->length++;
     }
 
     return tmp;
 }
 
 list_node *list_insert_after(linked_list *list, list_node *pos, void *data) {
+    list_node *tmp = NULL;
+
     if ((list == NULL) || (pos == NULL))
         return NULL;
 
     if (pos->next == NULL)
         return list_push_back(list, data);
-    else
-        return list_insert_before(list, pos->next, data);
+
+    tmp = new_node(list);
+    if (tmp) {
+        tmp->data = data;
+        tmp->next = pos->next;
+        pos->next = tmp;
+
+        list->length++;
+    }
+
+    return tmp;
 }
 
 list_node *list_push_back(linked_list *list, void *data) {
@@ -111,23 +159,18 @@ list_node *list_push_back(linked_list *list, void *data) {
     if (list == NULL)
         return NULL;
 
-    tmp = malloc(sizeof(list_node));
+    tmp = new_node(list);
     if (tmp) {
-        list_node *root = list_get_root(list);
-
-        memset(tmp, 0, sizeof(*tmp));
         tmp->data = data;
 
-        if (root) {
-            list_node *current = root;
+        if (list->tail)
+            list->tail->next = tmp;
+        else
+            list->root = tmp;
 
-            while (current->next != NULL)
-                current = current->next;
+        list->tail = tmp;
 
-            current->next = tmp;
-        } else {
-            list->root = tmp;
-        }
+        list->length++;
     }
 
     return tmp;
@@ -135,6 +178,7 @@ list_node *list_push_back(linked_list *list, void *data) {
 
 void list_dispose(linked_list **list, void (*free_content)(void *)) {
     list_node *current = NULL;
+    list_chunk *chunk = NULL;
 
     if ((list == NULL) || (*list == NULL))
         return;
@@ -142,13 +186,17 @@ void list_dispose(linked_list **list, void (*free_content)(void *)) {
     current = (*list)->root;
 
     while (current != NULL) {
-        list_node *next = current->next;
-
         if (free_content != NULL)
             free_content(current->data);
 
-        free(current);
-        current = next;
+        current = current->next;
+    }
+
+    for (chunk = (*list)->chunks; chunk != NULL;) {
+        list_chunk *next = chunk->next;
+
+        free(chunk);
+        chunk = next;
     }
 
     free(*list);
@@ -29,13 +29,19 @@ extern "C" {
 
 typedef struct linked_list linked_list;
 typedef struct list_node list_node;
+typedef struct list_chunk list_chunk;
 
 typedef linked_list list;
 
 struct linked_list {
     list_node *root;
+    list_node *tail;
     
     size_t length;
+
+    /* Nodes are allocated in chunks, the newest one first */
+    list_chunk *chunks;
+    size_t free_nodes;  /* Left in the newest chunk */
 };
 
 struct list_node {
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Relocatable objects written by "dcpu16asm -c" and linked by dcpu16ld.
+ * They are text, a line per section, symbol and relocation, followed by
+ * the words of the sections as a hexdump:
+ *
+ *   .dcpu16obj 1
+ *   .section rel 0000 0040      relocatable section, 0x40 words
+ *   .section abs 8000 0010      0x10 words at 0x8000
+ *   .export main rel 0000       label defined by the object
+ *   .export vram abs 8000
+ *   .import putc                label used but not defined
+ *   .reloc 0003                 word 0003 gets the section's address added
+ *   .reloc 0005 putc            word 0005 gets the address of putc
+ *   .words
+ *   0000: 7C01 0030 ...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "object.h"
+#include "hexdump.h"
+#include "types.h"
+
+/* Longest line and symbol name accepted */
+#define MAXLINE 256
+#define MAXNAME 128
+
+/* Grows 'array' of 'size' elements, if full, to hold at least 'count' + 1 */
+#define RESERVE(array, count, size) do {                                  \
+    if ((count) == (size)) {                                              \
+        void *p;                                                          \
+                                                                          \
+        (size) = (size) ? (size) * 2 : 16;                                \
+                                                                          \
+        if ((p = realloc((array), (size) * sizeof(*(array)))) == NULL)    \
+            goto fail;                                                    \
+                                                                          \
+        (array) = p;                                                      \
+    }                                                                     \
+} while (0)
+
+
+static int by_start(const void *a, const void *b) {
+    size_t x = ((const memextent*)a)->start, y = ((const memextent*)b)->start;
+
+    return (x > y) - (x < y);
+}
+
+int write_object(FILE *f, const dcpu16object *o) {
+    uint16_t *mem = calloc(RAMSIZE, sizeof(uint16_t));
+    memextent *extents = malloc((o->nsections + 1) * sizeof(memextent));
+    int i, n = 0, ret = -1;
+
+    if ((mem == NULL) || (extents == NULL))
+        goto done;
+
+    fprintf(f, "%s\n", OBJECT_MAGIC);
+
+    for (i = 0; i < o->nsections; ++i) {
+        const objsection *s = &(o->sections[i]);
+
+        fprintf(f, ".section %s %04X %04X\n", s->relocatable ? "rel" : "abs",
+                s->start, s->length);
+
+        if (!s->length)
+            continue;
+
+        if (s->start + s->length > RAMSIZE)
+            goto done;
+
+        memcpy(mem + s->start, s->words, s->length * sizeof(uint16_t));
+        extents[n].start = s->start;
+        extents[n++].end = s->start + s->length;
+    }
+
+    for (i = 0; i < o->nexports; ++i)
+        fprintf(f, ".export %s %s %04X\n", o->exports[i].name,
+                o->exports[i].relocatable ? "rel" : "abs",
+                o->exports[i].value);
+
+    for (i = 0; i < o->nimports; ++i)
+        fprintf(f, ".import %s\n", o->imports[i]);
+
+    for (i = 0; i < o->nrelocs; ++i) {
+        if (o->relocs[i].symbol != NULL)
+            fprintf(f, ".reloc %04X %s\n", o->relocs[i].addr,
+                    o->relocs[i].symbol);
+        else
+            fprintf(f, ".reloc %04X\n", o->relocs[i].addr);
+    }
+
+    fprintf(f, ".words\n");
+
+    /* The hexdump needs them in order, and not overlapping */
+    qsort(extents, n, sizeof(memextent), by_start);
+
+    for (i = 1; i < n; ++i)
+        if (extents[i].start < extents[i - 1].end)
+            goto done;
+
+    ret = write_hexdump_extents(f, BIGENDIAN, mem, extents, n);
+
+done:
+    free(extents);
+    free(mem);
+
+    return ret;
+}
+
+dcpu16object *read_object(FILE *f) {
+    dcpu16object *o = calloc(1, sizeof(dcpu16object));
+    uint16_t *mem = calloc(RAMSIZE, sizeof(uint16_t));
+    int sectionsize = 0, exportsize = 0, importsize = 0, relocsize = 0;
+    char line[MAXLINE], kind[8], name[MAXNAME];
+    unsigned int start, length;
+    int i;
+
+    if ((o == NULL) || (mem == NULL))
+        goto fail;
+
+    if ((fgets(line, sizeof(line), f) == NULL)
+            || strncmp(line, OBJECT_MAGIC, strlen(OBJECT_MAGIC)))
+        goto fail;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (!strncmp(line, ".words", 6))
+            break;
+
+        if (sscanf(line, ".section %7s %x %x", kind, &start, &length) == 3) {
+            objsection *s;
+
+            if ((start >= RAMSIZE) || (start + length > RAMSIZE))
+                goto fail;
+
+            RESERVE(o->sections, o->nsections, sectionsize);
+            s = &(o->sections[o->nsections++]);
+
+            s->start = start;
+            s->length = length;
+            s->relocatable = !strcmp(kind, "rel");
+            s->words = NULL;
+        } else if (sscanf(line, ".export %127s %7s %x", name, kind,
+                          &start) == 3) {
+            objsymbol *s;
+
+            RESERVE(o->exports, o->nexports, exportsize);
+            s = &(o->exports[o->nexports++]);
+
+            s->value = start;
+            s->relocatable = !strcmp(kind, "rel");
+
+            if ((s->name = strdup(name)) == NULL)
+                goto fail;
+        } else if (sscanf(line, ".import %127s", name) == 1) {
+            RESERVE(o->imports, o->nimports, importsize);
+
+            if ((o->imports[o->nimports++] = strdup(name)) == NULL)
+                goto fail;
+        } else if (!strncmp(line, ".reloc ", 7)) {
+            objreloc *r;
+            int fields = sscanf(line, ".reloc %x %127s", &start, name);
+
+            if (fields < 1)
+                goto fail;
+
+            RESERVE(o->relocs, o->nrelocs, relocsize);
+            r = &(o->relocs[o->nrelocs++]);
+
+            r->addr = start;
+            r->symbol = NULL;
+
+            if ((fields == 2) && ((r->symbol = strdup(name)) == NULL))
+                goto fail;
+        } else {
+            goto fail;
+        }
+    }
+
+    if (read_hexdump(f, BIGENDIAN, mem, RAMSIZE) < 0)
+        goto fail;
+
+    for (i = 0; i < o->nsections; ++i) {
+        objsection *s = &(o->sections[i]);
+
+        if ((s->words = malloc(s->length * sizeof(uint16_t) + 1)) == NULL)
+            goto fail;
+
+        memcpy(s->words, mem + s->start, s->length * sizeof(uint16_t));
+    }
+
+    free(mem);
+    return o;
+
+fail:
+    free(mem);
+    object_dispose(&o);
+
+    return NULL;
+}
+
+void object_dispose(dcpu16object **o) {
+    int i;
+
+    if (*o == NULL)
+        return;
+
+    for (i = 0; i < (*o)->nsections; ++i)
+        free((*o)->sections[i].words);
+
+    for (i = 0; i < (*o)->nexports; ++i)
+        free((*o)->exports[i].name);
+
+    for (i = 0; i < (*o)->nimports; ++i)
+        free((*o)->imports[i]);
+
+    for (i = 0; i < (*o)->nrelocs; ++i)
+        free((*o)->relocs[i].symbol);
+
+    free((*o)->sections);
+    free((*o)->exports);
+    free((*o)->imports);
+    free((*o)->relocs);
+    free(*o);
+
+    *o = NULL;
+}
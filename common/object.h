@@ -0,0 +1,60 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* First line of every object file */
+#define OBJECT_MAGIC ".dcpu16obj 1"
+
+/*
+ * Words assembled to consecutive addresses.  The relocatable section of an
+ * object starts at 0 and is placed by the linker, the absolute ones (after
+ * an .org) stay where they are.
+ */
+typedef struct {
+    uint16_t start;
+    uint32_t length;
+    int relocatable;
+    uint16_t *words;
+} objsection;
+
+/*
+ * A label defined by an object, at an offset into its relocatable section
+ * if 'relocatable' is set
+ */
+typedef struct {
+    char *name;
+    uint16_t value;
+    int relocatable;
+} objsymbol;
+
+/*
+ * A word to be set to the address of a label: the start of the relocatable
+ * section is added to it if 'symbol' is NULL, it is set to the value of the
+ * symbol defined by another object otherwise
+ */
+typedef struct {
+    uint16_t addr;
+    char *symbol;
+} objreloc;
+
+typedef struct {
+    objsection *sections;
+    int nsections;
+
+    objsymbol *exports;
+    int nexports;
+
+    char **imports;
+    int nimports;
+
+    objreloc *relocs;
+    int nrelocs;
+} dcpu16object;
+
+int write_object(FILE*, const dcpu16object*);
+dcpu16object *read_object(FILE*);
+void object_dispose(dcpu16object**);
+
+#endif
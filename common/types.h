@@ -5,6 +5,24 @@
 
 #define RAMSIZE 0x10000
 
+/*
+ * Memory mapped screen, one word per character cell
+ */
+#define VRAM        0x8000
+#define VRAMWIDTH   32
+#define VRAMHEIGHT  12
+
+/*
+ * Last key pressed
+ */
+#define KEYBOARD    0x9000
+
+/*
+ * RAM is tracked for checkpoints in pages of this many words
+ */
+#define PAGESIZE    256
+#define PAGES       (RAMSIZE / PAGESIZE)
+
 /*
  * Tokens
  *
@@ -38,8 +56,19 @@ typedef enum {
 typedef struct {
     char *label;
     uint16_t pc;
+    int line;       /* Of the definition, 0 until defined */
 
     int defined;
+    uint32_t hash;  /* Of 'label', see assembler/label.c */
+
+    /* Words referring to the label before it was defined */
+    struct dcpu16fixup *fixups;
+
+    /* Symbol the instruction at the label jumps to, -1 if not a jump */
+    int jump;
+
+    /* Set if 'pc' is an offset into the relocatable section of an object */
+    int relocatable;
 } dcpu16label;
 
 /*
@@ -70,7 +99,7 @@ typedef struct {
 
     union {
         int offset;
-        char *label;
+        int symbol;  /* Number of the label in the symbol table */
     };
 } dcpu16registeroffset;
 
@@ -81,7 +110,7 @@ typedef struct {
     union {
         dcpu16token token;
         int numeric;
-        char *label;
+        int symbol;  /* Number of the label in the symbol table */
         dcpu16registeroffset register_offset;
     };
 } dcpu16operand;
@@ -94,7 +123,7 @@ typedef struct {
     dcpu16operand b;
 } dcpu16instruction;
 
-typedef struct {
+typedef struct dcpu16 {
     uint16_t registers[8];
     uint16_t ram[RAMSIZE];
     uint16_t pc;
@@ -103,6 +132,28 @@ typedef struct {
 
     int skip_next;
     int idle;
+
+    uint64_t cycles;  /* Clock cycles elapsed since reset */
+
+    /* One bit per screen cell written to since the screen was last handed
+     * to the GUI, one word per row */
+    uint32_t vram_dirty[VRAMHEIGHT];
+
+    /* One bit per RAM page written to since the last checkpoint */
+    uint32_t ram_dirty[PAGES / 32];
+
+    /* Checksum of the last snapshot saved or restored, 0 if none, which a
+     * delta snapshot must be based on to be restored */
+    uint64_t snapshot;
+
+    struct dcpu16decoded *decoded;  /* Predecoded instructions, see cpu.c */
+
+    /* Called for every address written to, if set */
+    void (*invalidate)(struct dcpu16*, uint16_t);
+
+    struct dcpu16jit *jit;  /* Compiled code, see jit.c */
+
+    struct dcpu16trace *trace;  /* Execution trace, see cpu.h */
 } dcpu16;
 
 
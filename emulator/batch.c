@@ -0,0 +1,670 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * dcpu16batch runs many programs headless, spread over all cores, and checks
+ * their final state against the expectations given in a manifest.  Every
+ * task gets a CPU of its own, so tasks never influence each other.
+ *
+ * Tasks are dealt out to the workers in equal, contiguous shares.  A worker
+ * runs its own share from the back and, once that is exhausted, steals from
+ * the front of the others' shares, so a few long running programs do not
+ * leave the other threads idle.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cpu.h"
+#include "../common/hexdump.h"
+#include "../common/image.h"
+#include "../common/types.h"
+
+#define MAXLINE 4096
+
+typedef enum {
+    CHECK_REGISTER,
+    CHECK_PC,
+    CHECK_SP,
+    CHECK_O,
+    CHECK_RAM
+} checktype;
+
+/*
+ * An expectation on the final state.  Registers are checked against
+ * values[0], RAM checks compare 'count' words starting at 'index'.
+ */
+typedef struct {
+    checktype type;
+    uint16_t index;
+    uint32_t count;
+    uint16_t *values;
+} check;
+
+typedef struct {
+    uint64_t cycle;
+    uint16_t code;
+} keypress;
+
+typedef struct {
+    char *image;
+    int line;
+    int halt;
+    int bigendian;
+    int binary;
+    uint64_t max_cycles;
+    uint64_t max_instructions;
+
+    keypress *keys;
+    int nkeys;
+
+    check *checks;
+    int nchecks;
+
+    /* Results */
+    const char *stop;
+    uint64_t instructions;
+    uint64_t cycles;
+    char error[128];
+    char mismatch[128];
+} task;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+
+    /* Tasks [top, bottom) are yet to be run */
+    int top;
+    int bottom;
+} worker;
+
+static task *tasks = NULL;
+static int ntasks = 0;
+
+static worker *workers = NULL;
+static int nworkers = 0;
+
+static int flag_halt = 0;
+static int flag_be = 0;
+static int flag_quiet = 0;
+static uint64_t default_cycles = 100000000ULL;
+
+void display_help();
+
+int parse_count(const char*, uint64_t*);
+int read_manifest(FILE*, const char*);
+int parse_task(task*, char*);
+void run_task(task*);
+void check_task(task*, dcpu16*);
+void *work(void*);
+void print_results(double);
+
+int main(int argc, char **argv) {
+    int i;
+    uint64_t n;
+    int lopts_index = 0;
+    int failed = 0;
+    const char *fname = "-";
+    FILE *manifest = stdin;
+    struct timespec start, end;
+
+    static struct option lopts[] = {
+        {"help",         no_argument,       NULL, 'h'},
+        {"threads",      required_argument, NULL, 'j'},
+        {"max-cycles",   required_argument, NULL, 'c'},
+        {"halt",         no_argument,       NULL, 'H'},
+        {"bigendian",    no_argument,       NULL, 'b'},
+        {"quiet",        no_argument,       NULL, 'q'},
+        {NULL,           0,                 NULL,  0 }
+    };
+
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (;;) {
+        int opt = getopt_long(argc, argv, "hj:c:Hbq", lopts, &lopts_index);
+
+        if (opt < 0)
+            break;
+
+        switch (opt) {
+        case 'h':
+            display_help();
+            return 0;
+
+        case 'j':
+            if ((parse_count(optarg, &n) < 0) || (n < 1) || (n > 4096)) {
+                fprintf(stderr, "Invalid number of threads '%s' -- "
+                                "aborting\n", optarg);
+                return 1;
+            }
+
+            nworkers = n;
+            break;
+
+        case 'c':
+            if ((parse_count(optarg, &default_cycles) < 0)
+                    || (default_cycles == 0)) {
+                fprintf(stderr, "Invalid cycle limit '%s' -- aborting\n",
+                        optarg);
+                return 1;
+            }
+
+            break;
+
+        case 'H':
+            flag_halt = 1;
+            break;
+
+        case 'b':
+            flag_be = 1;
+            break;
+
+        case 'q':
+            flag_quiet = 1;
+            break;
+
+        case '?':
+            return 1;
+        }
+    }
+
+    if (nworkers < 1)
+        nworkers = 1;
+
+    if (optind < argc) {
+        fname = argv[optind++];
+
+        if (strcmp(fname, "-")) {
+            if ((manifest = fopen(fname, "r")) == NULL) {
+                fprintf(stderr, "Unable to open '%s' -- aborting\n", fname);
+                return 1;
+            }
+        }
+    }
+
+    if (read_manifest(manifest, fname) < 0)
+        return 1;
+
+    if (manifest != stdin)
+        fclose(manifest);
+
+    if (nworkers > ntasks)
+        nworkers = ntasks ? ntasks : 1;
+
+    if ((workers = calloc(nworkers, sizeof(worker))) == NULL) {
+        fprintf(stderr, "Out of memory -- aborting\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < nworkers; ++i) {
+        worker *w = &workers[i];
+
+        pthread_mutex_init(&w->lock, NULL);
+        w->top = (long)ntasks * i / nworkers;
+        w->bottom = (long)ntasks * (i + 1) / nworkers;
+    }
+
+    for (i = 0; i < nworkers; ++i) {
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i])) {
+            fprintf(stderr, "Unable to start worker thread -- aborting\n");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < nworkers; ++i)
+        pthread_join(workers[i].thread, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    print_results((end.tv_sec - start.tv_sec)
+                + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    for (i = 0; i < ntasks; ++i)
+        failed |= tasks[i].error[0] || tasks[i].mismatch[0];
+
+    return failed;
+}
+
+void display_help() {
+    printf("Usage: dcpu16batch [OPTIONS] [MANIFEST]\n"
+           "where OPTIONS is any of:\n"
+           "  -h, --help          Display this help\n"
+           "  -j, --threads N     Run N programs at a time (default: "
+                                 "number of CPUs)\n"
+           "  -c, --max-cycles N  Stop programs without a limit of their "
+                                 "own after N\n"
+           "                      cycles (default 100000000)\n"
+           "  -H, --halt          Stop all programs once the PC did not "
+                                 "change\n"
+           "  -b, --bigendian     Read all images as big endian\n"
+           "  -q, --quiet         Only list failed tasks\n"
+           "\n"
+           "MANIFEST lists one task per line (defaults to standard input):\n"
+           "  IMAGE [ITEM...]\n"
+           "where IMAGE is a hexdump or binary image as written by "
+                                 "dcpu16asm and ITEM is\n"
+           "any of:\n"
+           "  halt                Stop once the PC did not change\n"
+           "  bigendian           Read the image as big endian\n"
+           "  binary              The image is binary without a header\n"
+           "  cycles=N            Stop after N clock cycles\n"
+           "  instructions=N      Stop after N instructions\n"
+           "  key=CYCLE:CODE      Press the key CODE at clock cycle CYCLE\n"
+           "  REG=VALUE           Expect register REG (A-J, PC, SP or O) "
+                                 "to hold VALUE\n"
+           "  [ADDR]=VALUE,...    Expect the RAM starting at ADDR to "
+                                 "hold the VALUEs\n"
+           "Empty lines and lines starting with '#' are ignored.\n");
+}
+
+/*
+ * Reads a decimal, hexadecimal or octal count, rejecting anything else
+ */
+int parse_count(const char *s, uint64_t *n) {
+    char *end;
+
+    if (!isdigit((unsigned char)*s))
+        return -1;
+
+    errno = 0;
+    *n = strtoull(s, &end, 0);
+
+    return (*end || (errno == ERANGE)) ? -1 : 0;
+}
+
+/*
+ * Reads all tasks into 'tasks'.  Returns -1 after printing a message on
+ * errors.
+ */
+int read_manifest(FILE *f, const char *fname) {
+    char buffer[MAXLINE];
+    int line = 0;
+    int size = 0;
+
+    while (fgets(buffer, sizeof(buffer), f) != NULL) {
+        char *p = buffer;
+
+        line++;
+
+        while (isspace(*p))
+            p++;
+
+        if ((*p == '\0') || (*p == '#'))
+            continue;
+
+        if (ntasks == size) {
+            task *t;
+
+            size = size ? size * 2 : 64;
+
+            if ((t = realloc(tasks, size * sizeof(task))) == NULL) {
+                fprintf(stderr, "Out of memory -- aborting\n");
+                return -1;
+            }
+
+            tasks = t;
+        }
+
+        memset(&tasks[ntasks], 0, sizeof(task));
+        tasks[ntasks].line = line;
+
+        if (parse_task(&tasks[ntasks], p) < 0) {
+            fprintf(stderr, "%s:%d: Invalid task -- aborting\n", fname, line);
+            return -1;
+        }
+
+        ntasks++;
+    }
+
+    return 0;
+}
+
+static int parse_register(const char *name, check *c) {
+    static const char names[] = "ABCXYZIJ";
+
+    if (!strcmp(name, "PC")) {
+        c->type = CHECK_PC;
+    } else if (!strcmp(name, "SP")) {
+        c->type = CHECK_SP;
+    } else if (!strcmp(name, "O")) {
+        c->type = CHECK_O;
+    } else if ((strlen(name) == 1) && strchr(names, *name)) {
+        c->type = CHECK_REGISTER;
+        c->index = strchr(names, *name) - names;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_values(char *s, check *c) {
+    char *save = NULL;
+    char *v;
+
+    for (v = strtok_r(s, ",", &save); v; v = strtok_r(NULL, ",", &save)) {
+        char *end;
+        unsigned long n = strtoul(v, &end, 0);
+
+        if ((*end != '\0') || (n > 0xFFFF) || (c->count == RAMSIZE))
+            return -1;
+
+        if ((c->values = realloc(c->values,
+                                 (c->count + 1) * sizeof(uint16_t))) == NULL)
+            return -1;
+
+        c->values[c->count++] = n;
+    }
+
+    return c->count ? 0 : -1;
+}
+
+/*
+ * Parses a manifest line (modified in place)
+ */
+int parse_task(task *t, char *line) {
+    char *save = NULL;
+    char *item = strtok_r(line, " \t\r\n", &save);
+
+    if ((t->image = strdup(item)) == NULL)
+        return -1;
+
+    t->halt = flag_halt;
+    t->bigendian = flag_be;
+
+    while ((item = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        char *value = strchr(item, '=');
+
+        if (value != NULL)
+            *value++ = '\0';
+
+        if (!strcmp(item, "halt") && !value) {
+            t->halt = 1;
+        } else if (!strcmp(item, "bigendian") && !value) {
+            t->bigendian = 1;
+        } else if (!strcmp(item, "binary") && !value) {
+            t->binary = 1;
+        } else if (!value) {
+            return -1;
+        } else if (!strcmp(item, "cycles")) {
+            if (parse_count(value, &t->max_cycles) < 0)
+                return -1;
+        } else if (!strcmp(item, "instructions")) {
+            if (parse_count(value, &t->max_instructions) < 0)
+                return -1;
+        } else if (!strcmp(item, "key")) {
+            keypress *k;
+            char *code = strchr(value, ':');
+            uint64_t n;
+
+            if (code == NULL)
+                return -1;
+
+            *code++ = '\0';
+
+            if ((k = realloc(t->keys,
+                             (t->nkeys + 1) * sizeof(keypress))) == NULL)
+                return -1;
+
+            t->keys = k;
+
+            if ((parse_count(value, &k[t->nkeys].cycle) < 0)
+                    || (parse_count(code, &n) < 0) || (n > 0xFFFF))
+                return -1;
+
+            k[t->nkeys].code = n;
+
+            /* Keep them in order of time */
+            if (t->nkeys && (k[t->nkeys].cycle < k[t->nkeys - 1].cycle))
+                return -1;
+
+            t->nkeys++;
+        } else {
+            check *c;
+
+            if ((c = realloc(t->checks,
+                             (t->nchecks + 1) * sizeof(check))) == NULL)
+                return -1;
+
+            t->checks = c;
+            c = &c[t->nchecks++];
+            memset(c, 0, sizeof(*c));
+
+            if (*item == '[') {
+                char *end;
+                unsigned long addr = strtoul(item + 1, &end, 0);
+
+                if ((*end != ']') || (end[1] != '\0') || (addr >= RAMSIZE))
+                    return -1;
+
+                c->type = CHECK_RAM;
+                c->index = addr;
+            } else if (parse_register(item, c) < 0) {
+                return -1;
+            }
+
+            if (parse_values(value, c) < 0)
+                return -1;
+
+            if ((c->type != CHECK_RAM) && (c->count != 1))
+                return -1;
+        }
+    }
+
+    if (!t->max_cycles && !t->max_instructions)
+        t->max_cycles = default_cycles;
+
+    return 0;
+}
+
+/*
+ * Returns the index of the next task to run, or -1 if there is none left
+ */
+static int next_task(worker *self) {
+    int i, t = -1;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->top < self->bottom)
+        t = --self->bottom;
+    pthread_mutex_unlock(&self->lock);
+
+    for (i = 1; (t < 0) && (i < nworkers); ++i) {
+        worker *victim = &workers[(self - workers + i) % nworkers];
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->top < victim->bottom)
+            t = victim->top++;
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    return t;
+}
+
+void *work(void *arg) {
+    worker *self = arg;
+    int t;
+
+    while ((t = next_task(self)) >= 0)
+        run_task(&tasks[t]);
+
+    return NULL;
+}
+
+void run_task(task *t) {
+    dcpu16 *cpu = malloc(sizeof(dcpu16));
+    FILE *image;
+    int key = 0;
+
+    if ((cpu == NULL) || (dcpu16_init(cpu) < 0)) {
+        snprintf(t->error, sizeof(t->error), "out of memory");
+        free(cpu);
+        return;
+    }
+
+    if ((image = fopen(t->image, "r")) == NULL) {
+        snprintf(t->error, sizeof(t->error), "unable to open image");
+        goto out;
+    }
+
+    if ((t->binary || is_image(image))
+            ? (read_image(image, t->bigendian ? BIGENDIAN : LITTLEENDIAN,
+                          cpu->ram, RAMSIZE) < 0)
+            : (read_hexdump(image, t->bigendian ? BIGENDIAN : LITTLEENDIAN,
+                            cpu->ram, RAMSIZE) < 0)) {
+        snprintf(t->error, sizeof(t->error), "invalid image");
+        fclose(image);
+        goto out;
+    }
+
+    fclose(image);
+
+    /* Same as a headless dcpu16emu run */
+    while (t->stop == NULL) {
+        uint16_t pc = cpu->pc;
+
+        while ((key < t->nkeys) && (cpu->cycles >= t->keys[key].cycle))
+            dcpu16_poke(cpu, KEYBOARD, t->keys[key++].code);
+
+        dcpu16_step(cpu);
+        t->instructions++;
+
+        cpu->cycles += 1 + cpu->idle;
+        cpu->idle = 0;
+
+        if (t->halt && (pc == cpu->pc))
+            t->stop = "halted";
+        else if (t->max_cycles && (cpu->cycles >= t->max_cycles))
+            t->stop = "cycles";
+        else if (t->max_instructions
+                 && (t->instructions >= t->max_instructions))
+            t->stop = "instructions";
+    }
+
+    t->cycles = cpu->cycles;
+    check_task(t, cpu);
+
+out:
+    dcpu16_free(cpu);
+    free(cpu);
+}
+
+/*
+ * Records the first expectation not met in t->mismatch
+ */
+void check_task(task *t, dcpu16 *cpu) {
+    static const char names[] = "ABCXYZIJ";
+    int i;
+    uint32_t j;
+
+    for (i = 0; i < t->nchecks; ++i) {
+        check *c = &t->checks[i];
+        uint16_t actual;
+
+        switch (c->type) {
+        case CHECK_REGISTER:
+            if ((actual = cpu->registers[c->index]) != c->values[0]) {
+                snprintf(t->mismatch, sizeof(t->mismatch),
+                         "%c=%04X, expected %04X",
+                         names[c->index], actual, c->values[0]);
+                return;
+            }
+
+            break;
+
+        case CHECK_PC:
+        case CHECK_SP:
+        case CHECK_O:
+            actual = (c->type == CHECK_PC) ? cpu->pc
+                   : (c->type == CHECK_SP) ? cpu->sp : cpu->o;
+
+            if (actual != c->values[0]) {
+                snprintf(t->mismatch, sizeof(t->mismatch),
+                         "%s=%04X, expected %04X",
+                         (c->type == CHECK_PC) ? "PC"
+                       : (c->type == CHECK_SP) ? "SP" : "O",
+                         actual, c->values[0]);
+                return;
+            }
+
+            break;
+
+        case CHECK_RAM:
+            for (j = 0; j < c->count; ++j) {
+                uint16_t addr = c->index + j;
+
+                if ((actual = cpu->ram[addr]) != c->values[j]) {
+                    snprintf(t->mismatch, sizeof(t->mismatch),
+                             "[%04X]=%04X, expected %04X",
+                             addr, actual, c->values[j]);
+                    return;
+                }
+            }
+
+            break;
+        }
+    }
+}
+
+void print_results(double seconds) {
+    int i, passed = 0, failed = 0, errors = 0;
+    uint64_t instructions = 0;
+
+    printf("%5s %-6s %-12s %12s %12s  %s\n", "LINE",
+           "RESULT", "STOPPED", "INSTRUCTIONS", "CYCLES", "IMAGE");
+
+    for (i = 0; i < ntasks; ++i) {
+        task *t = &tasks[i];
+        const char *result = "ok";
+
+        instructions += t->instructions;
+
+        if (t->error[0]) {
+            result = "ERROR";
+            errors++;
+        } else if (t->mismatch[0]) {
+            result = "FAIL";
+            failed++;
+        } else {
+            passed++;
+
+            if (flag_quiet)
+                continue;
+        }
+
+        printf("%5d %-6s %-12s %12llu %12llu  %s %s\n", t->line,
+               result, t->stop ? t->stop : "-",
+               (unsigned long long)t->instructions,
+               (unsigned long long)t->cycles, t->image,
+               t->error[0] ? t->error : t->mismatch);
+    }
+
+    printf("%d tasks: %d passed, %d failed, %d errors in %.3fs on %d "
+           "threads (%.1f MIPS)\n", ntasks, passed, failed, errors,
+           seconds, nworkers, seconds > 0 ? instructions / seconds / 1e6 : 0);
+}
@@ -0,0 +1,495 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * The emulator core, shared by all tools running DCPU-16 code.  All state
+ * lives in the dcpu16 struct, so any number of CPUs can run concurrently.
+ *
+ * Instructions are decoded into cpu->decoded, one slot per address.  A slot
+ * is decoded the first time the PC reaches it and dropped again as soon as
+ * any of the words it was decoded from is written to, so self-modifying code
+ * keeps working.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "../common/dcpu16.h"
+#include "../common/types.h"
+
+/*
+ * Resets the CPU and allocates its instruction cache.  Returns -1 if out of
+ * memory.
+ */
+int dcpu16_init(dcpu16 *cpu) {
+    memset(cpu, 0, sizeof(*cpu));
+
+    /* Nothing has been checkpointed yet */
+    memset(cpu->ram_dirty, 0xFF, sizeof(cpu->ram_dirty));
+
+    if ((cpu->decoded = calloc(RAMSIZE, sizeof(dcpu16decoded))) == NULL)
+        return -1;
+
+    return 0;
+}
+
+void dcpu16_free(dcpu16 *cpu) {
+    free(cpu->decoded);
+    cpu->decoded = NULL;
+}
+
+int dcpu16_get_operand(uint8_t raw, dcpu16operand *op, dcpu16 *cpu) {
+    if (raw < 0x08) {
+        op->type = REGISTER;
+        op->addressing = IMMEDIATE;
+        op->token = raw + T_A;
+    } else if ((raw >= 0x08) && (raw < 0x10)) {
+        op->type = REGISTER;
+        op->addressing = REFERENCE;
+        op->token = (raw % 0x8) + T_A;
+    } else if ((raw >= 0x10) && (raw < 0x18)) {
+        op->type = REGISTER_OFFSET;
+        op->addressing = REFERENCE;
+        op->register_offset.type = LITERAL;
+        op->register_offset.register_index = (raw % 0x8) + T_A;
+        op->register_offset.offset = cpu->ram[cpu->pc++];
+    } else if ((raw >= 0x18) && (raw < 0x20)) {
+        op->addressing = IMMEDIATE;
+        op->type = REGISTER;
+
+        switch (raw) {
+        case 0x18: op->token = T_POP; break;
+        case 0x19: op->token = T_PEEK; break;
+        case 0x1A: op->token = T_PUSH; break;
+        case 0x1B: op->token = T_SP; break;
+        case 0x1C: op->token = T_PC; break;
+        case 0x1D: op->token = T_O; break;
+        case 0x1E: 
+            op->type = LITERAL;
+            op->addressing = REFERENCE;
+            op->numeric = cpu->ram[cpu->pc++];
+
+            break;
+
+        case 0x1F:
+            op->numeric = cpu->ram[cpu->pc++];
+            op->type = LITERAL;
+
+            break;
+        }
+    } else if ((raw >= 0x20) && (raw < 0x40)) {
+        op->type = LITERAL;
+        op->addressing = IMMEDIATE;
+        op->numeric = raw - 0x20;
+    }
+
+    return 0;
+}
+
+
+void dcpu16_fetch(dcpu16instruction *instr, dcpu16 *cpu) {
+    uint16_t word = cpu->ram[cpu->pc++];
+    uint16_t inst = word & 0x000F;
+    uint8_t a = (word & 0x03F0) >> 4;
+    uint8_t b = (word & 0xFC00) >> 10;
+
+    dcpu16operand opa, opb;
+
+    instr->opcode = T_SET + inst - 1;
+
+    /* Nonbasic instruction => opcode = a, a = b, b = nothing */
+    if (inst == 0x0) {
+        switch (a) {
+            case 0x01: instr->opcode = T_JSR; break;
+            default:   return;
+        }
+
+        a = b;
+
+        dcpu16_get_operand(a, &opa, cpu);
+
+        instr->a = opa;
+    } else {
+        dcpu16_get_operand(a, &opa, cpu);
+        dcpu16_get_operand(b, &opb, cpu);
+
+        instr->a = opa;
+        instr->b = opb;
+    }
+}
+
+void dcpu16_poke(dcpu16 *cpu, uint16_t addr, uint16_t val) {
+    cpu->ram[addr] = val;
+
+    /* An instruction is at most three words long */
+    cpu->decoded[addr].valid = 0;
+    cpu->decoded[(uint16_t)(addr - 1)].valid = 0;
+    cpu->decoded[(uint16_t)(addr - 2)].valid = 0;
+
+    if ((addr >= VRAM) && (addr < VRAM + VRAMWIDTH * VRAMHEIGHT))
+        cpu->vram_dirty[(addr - VRAM) / VRAMWIDTH] |=
+            1u << ((addr - VRAM) % VRAMWIDTH);
+
+    cpu->ram_dirty[addr / PAGESIZE / 32] |= 1u << ((addr / PAGESIZE) % 32);
+
+    if (cpu->invalidate != NULL)
+        cpu->invalidate(cpu, addr);
+}
+
+/*
+ * To be called after changing 'count' words of RAM starting at 'addr' behind
+ * dcpu16_poke()'s back.  Does not mark the RAM dirty for checkpoints.
+ */
+void dcpu16_invalidate(dcpu16 *cpu, uint16_t addr, uint32_t count) {
+    uint32_t i;
+
+    for (i = 0; i < count + 2; ++i)
+        cpu->decoded[(uint16_t)(addr - 2 + i)].valid = 0;
+
+    for (i = 0; i < count; ++i) {
+        uint16_t a = addr + i;
+
+        if ((a >= VRAM) && (a < VRAM + VRAMWIDTH * VRAMHEIGHT))
+            cpu->vram_dirty[(a - VRAM) / VRAMWIDTH] |=
+                1u << ((a - VRAM) % VRAMWIDTH);
+
+        if (cpu->invalidate != NULL)
+            cpu->invalidate(cpu, a);
+    }
+}
+
+static uint16_t load(dcpu16operand *op, dcpu16 *cpu) {
+#define TOREG(r) ((r) - T_A)
+    switch (op->type) {
+    case REGISTER:
+        if (op->addressing == IMMEDIATE) {
+            switch (op->token) {
+            case T_POP: return cpu->ram[cpu->sp++]; break;
+            case T_PEEK: return cpu->ram[cpu->sp]; break;
+            case T_PUSH: return cpu->ram[--cpu->sp]; break;
+            case T_SP: return cpu->sp; break;
+            case T_PC: return cpu->pc; break;
+            case T_O: return cpu->o; break;
+            default: return cpu->registers[TOREG(op->token)];
+            }
+        } else {
+            return cpu->ram[cpu->registers[TOREG(op->token)]];
+        }
+
+    case REGISTER_OFFSET:
+        return cpu->ram[(uint16_t)(cpu->registers[
+                            TOREG(op->register_offset.register_index)]
+                        + op->register_offset.offset)];
+
+    case LITERAL:
+        if (op->addressing == IMMEDIATE)
+            return op->numeric;
+        else
+            return cpu->ram[op->numeric];
+
+    default: break;
+    }
+
+    return 0;
+#undef TOREG
+}
+
+static void store(dcpu16operand *op, uint16_t val, dcpu16 *cpu) {
+#define TOREG(r) ((r) - T_A)
+    switch (op->type) {
+    case REGISTER:
+        if (op->addressing == IMMEDIATE) {
+                switch (op->token) {
+                case T_POP: dcpu16_poke(cpu, cpu->sp++, val); break;
+                case T_PEEK: dcpu16_poke(cpu, cpu->sp, val); break;
+                case T_PUSH: dcpu16_poke(cpu, --cpu->sp, val); break;
+                case T_SP: cpu->sp = val; break;
+                case T_PC: cpu->pc = val; break;
+                case T_O: cpu->o = val; break;
+                default: cpu->registers[TOREG(op->token)] = val;
+                }
+        } else {
+            dcpu16_poke(cpu, cpu->registers[TOREG(op->token)], val);
+        }
+
+        break;
+
+    case REGISTER_OFFSET:
+        dcpu16_poke(cpu, cpu->registers[
+                            TOREG(op->register_offset.register_index)]
+                         + op->register_offset.offset, val);
+        break;
+
+    case LITERAL:
+        if (op->addressing == IMMEDIATE)
+            ; /* Skip but don't complain */
+        else
+            dcpu16_poke(cpu, op->numeric, val);
+
+        break;
+
+    default: break;
+    }
+
+    return;
+#undef TOREG
+}
+
+/*
+ * Opcode implementations, see dcpu16handler
+ */
+static int op_jsr(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)b; (void)result;
+
+    dcpu16_poke(cpu, --cpu->sp, cpu->pc);
+    cpu->pc = a;
+
+    return 2;
+}
+
+static int op_set(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)cpu; (void)a;
+
+    *result = b;
+    return 1;
+}
+
+static int op_add(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    *result = a + b;
+    cpu->o = ((*result < a) || (*result < b));
+    return 2;
+}
+
+static int op_sub(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    *result = a - b;
+    cpu->o = (*result > a) ? 0xFFFF : 0;
+    return 2;
+}
+
+static int op_mul(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    uint32_t product = (uint32_t)a * b;
+
+    *result = product;
+    cpu->o = (product >> 16) & 0xFFFF;
+    return 2;
+}
+
+static int op_div(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    if (b != 0) {
+        *result = a / b;
+        cpu->o = ((a << 16) / b) & 0xFFFF;
+    } else {
+        *result = 0;
+        cpu->o = 0;
+    }
+
+    return 3;
+}
+
+static int op_mod(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)cpu;
+
+    *result = (b != 0) ? (a % b) : 0;
+    return 3;
+}
+
+static int op_shl(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    *result = a << b;
+    cpu->o = ((a << b) >> 16) & 0xFFFF;
+    return 2;
+}
+
+static int op_shr(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    *result = a >> b;
+    cpu->o = ((a << 16) >> b) & 0xFFFF;
+    return 2;
+}
+
+static int op_and(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)cpu;
+
+    *result = a & b;
+    return 1;
+}
+
+static int op_bor(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)cpu;
+
+    *result = a | b;
+    return 1;
+}
+
+static int op_xor(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)cpu;
+
+    *result = a ^ b;
+    return 1;
+}
+
+static int op_ife(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)result;
+
+    cpu->skip_next = !(a == b);
+    return 2 + cpu->skip_next;
+}
+
+static int op_ifn(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)result;
+
+    cpu->skip_next =  (a == b);
+    return 2 + cpu->skip_next;
+}
+
+static int op_ifg(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)result;
+
+    cpu->skip_next = !(a > b);
+    return 2 + cpu->skip_next;
+}
+
+static int op_ifb(dcpu16 *cpu, uint16_t a, uint16_t b, uint16_t *result) {
+    (void)result;
+
+    cpu->skip_next =  (a & b) == 0;
+    return 2 + cpu->skip_next;
+}
+
+/* Indexed by (opcode - T_SET) */
+static const dcpu16handler handlers[] = {
+    op_set, op_add, op_sub, op_mul, op_div, op_mod, op_shl, op_shr,
+    op_and, op_bor, op_xor, op_ife, op_ifn, op_ifg, op_ifb, op_jsr
+};
+
+void dcpu16_decode(dcpu16decoded *d, dcpu16 *cpu) {
+    dcpu16instruction instr = {0};
+    uint16_t pc = cpu->pc;
+
+    dcpu16_fetch(&instr, cpu);
+
+    d->a = instr.a;
+    d->b = instr.b;
+    d->length = (uint16_t)(cpu->pc - pc);
+    d->cost = uses_next_word(&(instr.a)) + uses_next_word(&(instr.b));
+    d->writes = (instr.opcode >= T_SET) && (instr.opcode <= T_XOR);
+    d->valid = 1;
+
+    /* Unknown nonbasic opcodes are silently skipped */
+    if (is_instruction(instr.opcode))
+        d->handler = handlers[instr.opcode - T_SET];
+    else
+        d->handler = NULL;
+
+    cpu->pc = pc;
+}
+
+void dcpu16_execute(dcpu16decoded *d, dcpu16 *cpu) {
+    uint16_t result = 0;
+    uint16_t a, b;
+
+    if (d->handler == NULL)
+        return;
+
+    a = load(&(d->a), cpu);
+    b = load(&(d->b), cpu);
+
+    cpu->idle = d->cost + d->handler(cpu, a, b, &result);
+
+    if (d->writes)
+        store(&(d->a), result, cpu);
+}
+
+/*
+ * Starts recording a step, to be called before the instruction is fetched
+ */
+dcpu16tracerecord *dcpu16_trace_begin(dcpu16 *cpu) {
+    dcpu16trace *t = cpu->trace;
+    dcpu16tracerecord *r = &(t->records[t->head & t->mask]);
+
+    r->cycle = cpu->cycles;
+    r->pc = cpu->pc;
+    r->words[0] = cpu->ram[cpu->pc];
+    r->words[1] = cpu->ram[(uint16_t)(cpu->pc + 1)];
+    r->words[2] = cpu->ram[(uint16_t)(cpu->pc + 2)];
+    r->a = r->b = r->result = r->flags = 0;
+
+    return r;
+}
+
+void dcpu16_trace_end(dcpu16 *cpu) {
+    dcpu16trace *t = cpu->trace;
+
+    if (!(++t->head & t->mask) && (t->flush != NULL))
+        t->flush(t);
+}
+
+/*
+ * dcpu16_step() while tracing, for either engine
+ */
+void dcpu16_traced_step(dcpu16 *cpu) {
+    dcpu16tracerecord *r = dcpu16_trace_begin(cpu);
+    dcpu16decoded *d = &(cpu->decoded[cpu->pc]);
+    uint16_t result = 0;
+
+    if (!d->valid)
+        dcpu16_decode(d, cpu);
+
+    cpu->pc += d->length;
+
+    if (cpu->skip_next) {
+        cpu->skip_next = cpu->idle = 0;
+        r->flags = TRACE_SKIPPED;
+    } else if (d->handler != NULL) {
+        r->a = load(&(d->a), cpu);
+        r->b = load(&(d->b), cpu);
+
+        cpu->idle = d->cost + d->handler(cpu, r->a, r->b, &result);
+
+        if (d->writes) {
+            store(&(d->a), result, cpu);
+            r->result = result;
+            r->flags = TRACE_WRITES;
+        }
+    }
+
+    dcpu16_trace_end(cpu);
+}
+
+#ifndef DCPU16_THREADED
+void dcpu16_step(dcpu16 *cpu) {
+    dcpu16decoded *d = &(cpu->decoded[cpu->pc]);
+
+    if (cpu->trace != NULL) {
+        dcpu16_traced_step(cpu);
+        return;
+    }
+
+    if (!d->valid)
+        dcpu16_decode(d, cpu);
+
+    cpu->pc += d->length;
+
+    if (!cpu->skip_next)
+        dcpu16_execute(d, cpu);
+    else
+        cpu->skip_next = cpu->idle = 0;
+
+}
+#endif
@@ -0,0 +1,74 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "../common/types.h"
+
+
+/*
+ * Implementation of a single opcode.  Receives the already loaded values of
+ * both operands, writes the value to store into 'a' (if any) into the last
+ * argument and returns the base cost of the instruction in cycles.
+ */
+typedef int (*dcpu16handler)(dcpu16*, uint16_t, uint16_t, uint16_t*);
+
+/*
+ * An entry in the predecoded instruction cache
+ */
+struct dcpu16decoded {
+    dcpu16handler handler;
+    dcpu16operand a;
+    dcpu16operand b;
+
+    uint8_t length;  /* Length of the instruction in words */
+    uint8_t cost;    /* Cycles spent on fetching next words */
+    uint8_t writes;  /* Whether the result is stored back into 'a' */
+    uint8_t valid;
+};
+
+typedef struct dcpu16decoded dcpu16decoded;
+
+/* dcpu16tracerecord.flags */
+#define TRACE_SKIPPED 0x0001  /* Skipped by an IF* */
+#define TRACE_WRITES  0x0002  /* 'result' was stored into operand a */
+
+/*
+ * What the CPU did in a single step
+ */
+typedef struct {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t words[3];  /* The instruction, possibly followed by others */
+    uint16_t a;         /* Values of the operands */
+    uint16_t b;
+    uint16_t result;
+    uint16_t flags;
+} dcpu16tracerecord;
+
+/*
+ * Ring buffer of the last steps.  If 'flush' is set, it is called whenever
+ * the buffer has been filled up and is about to be overwritten.
+ */
+typedef struct dcpu16trace {
+    dcpu16tracerecord *records;
+    uint32_t mask;  /* Number of records - 1, a power of two */
+    uint64_t head;  /* Number of records written so far */
+
+    void (*flush)(struct dcpu16trace*);
+} dcpu16trace;
+
+int dcpu16_init(dcpu16*);
+void dcpu16_free(dcpu16*);
+
+void dcpu16_step(dcpu16*);
+void dcpu16_traced_step(dcpu16*);
+void dcpu16_fetch(dcpu16instruction*, dcpu16*);
+void dcpu16_decode(dcpu16decoded*, dcpu16*);
+void dcpu16_execute(dcpu16decoded*, dcpu16*);
+void dcpu16_poke(dcpu16*, uint16_t, uint16_t);
+void dcpu16_invalidate(dcpu16*, uint16_t, uint32_t);
+int dcpu16_get_operand(uint8_t, dcpu16operand*, dcpu16*);
+
+dcpu16tracerecord *dcpu16_trace_begin(dcpu16*);
+void dcpu16_trace_end(dcpu16*);
+
+#endif
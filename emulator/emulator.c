@@ -27,56 +27,160 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "gui.h"
+#include "cpu.h"
+#include "jit.h"
+#include "render.h"
+#include "libdcpu16.h"
+#include "profile.h"
+#include "trace.h"
 #include "../common/hexdump.h"
 #include "../common/dcpu16.h"
+#include "../common/disassemble.h"
+#include "../common/image.h"
 #include "../common/types.h"
 
 
-void _usleep(unsigned long);
-void dcpu16_init(dcpu16*);
-void dcpu16_step(dcpu16*);
-void dcpu16_fetch(dcpu16instruction*, dcpu16*);
-void dcpu16_execute(dcpu16instruction*, dcpu16*);
-uint16_t *dcpu16_lookup_opcode(uint8_t, dcpu16*);
-
 int dcpu16_get_operandtype(uint8_t, dcpu16operandtype*,
                                     dcpu16addressing*);
 
 void display_help();
 
 void emulate(dcpu16*);
-void disassemble(dcpu16*);
+void emulate_headless(dcpu16*);
+void disassemble_program(dcpu16*);
+void dump_state(dcpu16*);
+int parse_range(const char*);
+int parse_count(const char*, uint64_t*);
+int read_replay(const char*);
 
 static int flag_disassemble = 0;
 static int flag_verbose = 0;
 static int flag_be = 0;
+static int flag_binary = 0;
 static int flag_halt = 0;
+static int flag_jit = 0;
+static int flag_headless = 0;
+static int flag_turbo = 0;
+
+/*
+ * Clock rate of the emulated CPU, scaled by 'speed'.  Unless running in turbo
+ * mode, the emulator executes SLICE nanoseconds worth of cycles at a time and
+ * then sleeps until that much time has passed since the last slice.
+ *
+ * An instruction takes the cycle it is executed in plus its cost, one more
+ * than in the spec.  That is how cycles were always counted here, and what
+ * recorded key logs, profiles and "dcpu16asm --listing" agree on.
+ */
+#define CLOCKRATE   100000
+#define SLICE       1000000L
+#define ONE_SECOND  1000000000L
+
+/* Cycles executed per slice in turbo mode */
+#define TURBO_SLICE 10000
+
+/* If we fall behind more than this, give up catching up */
+#define MAX_LAG     (100 * SLICE)
+
+static double speed = 1.0;
 
-/* So we can return a pointer to a literal value */
-static uint16_t literals[32] = {0};
+/* Screen refreshs per second */
+static int fps = 60;
+
+/*
+ * Limits for headless runs, 0 if unlimited
+ */
+static uint64_t max_cycles = 0;
+static uint64_t max_instructions = 0;
+static double time_limit = 0;
+
+/* RAM ranges to dump after a headless run */
+#define MAXDUMPS 16
+
+static struct {
+    uint16_t start;
+    uint32_t end;
+} dumps[MAXDUMPS];
+
+static int ndumps = 0;
+
+/* Snapshot files to start from and to write when done */
+static const char *restore_state = NULL;
+static const char *save_state = NULL;
+
+static uint64_t instructions = 0;
+
+/* Key presses are logged here along with the cycle they happened at */
+static FILE *record = NULL;
+
+/* Key presses to replay, in order */
+static struct {
+    uint64_t cycle;
+    uint16_t code;
+} *replay = NULL;
+
+static int nreplay = 0;
+
+/* Where to write the profile to, if profiling */
+static const char *profile = NULL;
+
+/* Execution trace file, and whether to write all records or only the last
+ * trace_size ones */
+static const char *trace_file = NULL;
+static int flag_trace_stream = 0;
+static uint32_t trace_size = 65536;
+
+/* Set by ^C, stops emulating so everything is written as usual */
+static volatile sig_atomic_t interrupted = 0;
+
+static void handleinterrupt(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
 
 /*
  * TODO: * Improve reading in program file
- *       * Emulate clockrate (100 kHz) and clock cycles
  */
 int main(int argc, char **argv) {
-    int i;
     int lopts_index = 0;
+    char *end;
+    uint64_t size;
     FILE *source = stdin;
 
     static struct option lopts[] = {
         {"verbose",      no_argument, NULL, 'v'},
         {"help",         no_argument, NULL, 'h'},
         {"bigendian",    no_argument, NULL, 'b'},
+        {"binary",       no_argument, NULL, 'B'},
         {"disassemble",  no_argument, NULL, 'd'},
         {"halt",         no_argument, NULL, 'H'},
+        {"jit",          no_argument, NULL, 'j'},
+        {"headless",     no_argument, NULL, 'n'},
+        {"speed",        required_argument, NULL, 's'},
+        {"turbo",        no_argument, NULL, 'T'},
+        {"fps",          required_argument, NULL, 'f'},
+        {"max-cycles",       required_argument, NULL, 'c'},
+        {"max-instructions", required_argument, NULL, 'i'},
+        {"time-limit",       required_argument, NULL, 't'},
+        {"dump",             required_argument, NULL, 'D'},
+        {"save-state",       required_argument, NULL, 'S'},
+        {"restore-state",    required_argument, NULL, 'R'},
+        {"record",           required_argument, NULL, 'r'},
+        {"replay",           required_argument, NULL, 'p'},
+        {"profile",          required_argument, NULL, 'P'},
+        {"map",              required_argument, NULL, 'm'},
+        {"trace",            required_argument, NULL, 'x'},
+        {"trace-stream",     required_argument, NULL, 'X'},
+        {"trace-size",       required_argument, NULL, 'Z'},
         {NULL,           0,           NULL,  0 }
     };
 
     for (;;) {
-        int opt = getopt_long(argc, argv, "vdhHb", lopts, &lopts_index);
+        int opt = getopt_long(argc, argv, "vdhHbBjns:Tf:c:i:t:D:S:R:r:"
+                                          "p:P:m:x:X:Z:", lopts, &lopts_index);
 
         if (opt < 0)
             break;
@@ -106,6 +210,137 @@ int main(int argc, char **argv) {
             flag_be = 1;
             break;
 
+        case 'B':
+            flag_binary = 1;
+            break;
+
+        case 'j':
+            flag_jit = 1;
+            break;
+
+        case 'n':
+            flag_headless = 1;
+            break;
+
+        case 's':
+            speed = strtod(optarg, NULL);
+
+            if (speed <= 0) {
+                fprintf(stderr, "Invalid speed '%s' -- aborting\n", optarg);
+                return 1;
+            }
+
+            break;
+
+        case 'T':
+            flag_turbo = 1;
+            break;
+
+        case 'f':
+            fps = atoi(optarg);
+
+            if (fps <= 0) {
+                fprintf(stderr, "Invalid frame rate '%s' -- aborting\n",
+                        optarg);
+                return 1;
+            }
+
+            break;
+
+        case 'c':
+            if (parse_count(optarg, &max_cycles) < 0) {
+                fprintf(stderr, "Invalid cycle limit '%s' -- aborting\n",
+                        optarg);
+                return 1;
+            }
+
+            break;
+
+        case 'i':
+            if (parse_count(optarg, &max_instructions) < 0) {
+                fprintf(stderr, "Invalid instruction limit '%s' -- "
+                                "aborting\n", optarg);
+                return 1;
+            }
+
+            break;
+
+        case 't':
+            time_limit = strtod(optarg, &end);
+
+            if ((end == optarg) || *end || !(time_limit >= 0)) {
+                fprintf(stderr, "Invalid time limit '%s' -- aborting\n",
+                        optarg);
+                return 1;
+            }
+
+            break;
+
+        case 'D':
+            if (parse_range(optarg) < 0) {
+                fprintf(stderr, "Invalid range '%s' -- aborting\n", optarg);
+                return 1;
+            }
+
+            break;
+
+        case 'S':
+            save_state = optarg;
+            break;
+
+        case 'R':
+            restore_state = optarg;
+            break;
+
+        case 'r':
+            if ((record = fopen(optarg, "w")) == NULL) {
+                fprintf(stderr, "Unable to open '%s' -- aborting\n", optarg);
+                return 1;
+            }
+
+            /* The emulator is usually left with ^C */
+            setvbuf(record, NULL, _IOLBF, 0);
+
+            break;
+
+        case 'p':
+            if (read_replay(optarg) < 0)
+                return 1;
+
+            flag_headless = 1;
+            break;
+
+        case 'P':
+            profile = optarg;
+            break;
+
+        case 'm':
+            if (profile_load_map(optarg) < 0)
+                return 1;
+
+            break;
+
+        case 'x':
+            trace_file = optarg;
+            flag_trace_stream = 0;
+            break;
+
+        case 'X':
+            trace_file = optarg;
+            flag_trace_stream = 1;
+            break;
+
+        case 'Z':
+            if ((parse_count(optarg, &size) < 0) || (size == 0)
+                    || (size > UINT32_MAX)) {
+                fprintf(stderr, "Invalid trace size '%s' -- aborting\n",
+                        optarg);
+                return 1;
+            }
+
+            trace_size = size;
+            break;
+
         case '?':
             break;
         }
@@ -125,44 +360,101 @@ int main(int argc, char **argv) {
         }
     }
 
-    initgui();
+    if (flag_jit && (profile != NULL)) {
+        fprintf(stderr, "Compiled code can not be profiled -- interpreting\n");
+        flag_jit = 0;
+    }
+
+    if (flag_jit && (trace_file != NULL)) {
+        fprintf(stderr, "Compiled code can not be traced -- interpreting\n");
+        flag_jit = 0;
+    }
 
     dcpu16 cpu;
-    dcpu16_init(&cpu);
 
-    /* Read program into memory */
-    read_hexdump(source, flag_be ? BIGENDIAN : LITTLEENDIAN, cpu.ram, RAMSIZE);
+    if (dcpu16_init(&cpu) < 0) {
+        fprintf(stderr, "Out of memory -- aborting\n");
+        return 1;
+    }
+
+    if (flag_jit && (dcpu16_jit_init(&cpu) < 0)) {
+        fprintf(stderr, "JIT compilation not available -- interpreting\n");
+        flag_jit = 0;
+    }
+
+    if (restore_state != NULL) {
+        if (dcpu16_restore_file(&cpu, restore_state) < 0) {
+            fprintf(stderr, "Unable to restore '%s' -- aborting\n",
+                    restore_state);
+            return 1;
+        }
+    } else if (flag_binary || is_image(source)) {
+        if (read_image(source, flag_be ? BIGENDIAN : LITTLEENDIAN,
+                       cpu.ram, RAMSIZE) < 0) {
+            fprintf(stderr, "Invalid binary image -- aborting\n");
+            return 1;
+        }
+    } else {
+        /* Read program into memory */
+        read_hexdump(source, flag_be ? BIGENDIAN : LITTLEENDIAN,
+                     cpu.ram, RAMSIZE);
+    }
 
     if (source != stdin)
         fclose(source);
 
-    /* Initialize literal table */
-    for (i = 0; i < 32; ++i)
-        literals[i] = i;
+    if ((trace_file != NULL) && !flag_disassemble) {
+        cpu.trace = trace_open(trace_file, trace_size, flag_trace_stream);
 
-    if (!flag_disassemble)
-        emulate(&cpu);
+        if (cpu.trace == NULL) {
+            fprintf(stderr, "Unable to open '%s' -- aborting\n", trace_file);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, handleinterrupt);
+
+    if (!flag_headless && !flag_disassemble)
+        initgui();
+
+    if (flag_disassemble)
+        disassemble_program(&cpu);
+    else if (flag_headless)
+        emulate_headless(&cpu);
     else
-        printf("BRB FIXING\n"); // TODO: TODO: TODO: !!
+        emulate(&cpu);
 
-    cleanupgui();
+    if (!flag_headless && !flag_disassemble)
+        cleanupgui();
 
-    return 0;
-}
+    if ((cpu.trace != NULL) && (trace_close(cpu.trace) < 0))
+        fprintf(stderr, "Unable to write '%s'\n", trace_file);
 
-#define ONE_SECOND 1000000
+    if (record != NULL)
+        fclose(record);
 
-void _usleep(unsigned long us) {
-    struct timespec req = {0};
-    time_t sec = us / ONE_SECOND;
-    time_t usec = us - sec * ONE_SECOND;
-    req.tv_sec = sec;
-    req.tv_nsec = usec * 1000;
+    if (profile != NULL) {
+        FILE *f = strcmp(profile, "-") ? fopen(profile, "w") : stdout;
 
-    while (nanosleep(&req, &req) == -1)
-        continue;
+        if (f != NULL) {
+            profile_report(f);
 
-    return;
+            if (f != stdout)
+                fclose(f);
+        } else {
+            fprintf(stderr, "Unable to write '%s'\n", profile);
+        }
+    }
+
+    if ((save_state != NULL) && (dcpu16_save_file(&cpu, save_state, 0) < 0))
+        fprintf(stderr, "Unable to write '%s'\n", save_state);
+
+    if (flag_jit)
+        dcpu16_jit_cleanup(&cpu);
+
+    dcpu16_free(&cpu);
+
+    return 0;
 }
 
 void display_help() {
@@ -173,6 +465,12 @@ void display_help() {
            "  -b, --bigendian     Interpret the words in the source file as "
                                  "big endian\n"
            "                      rather than little endian.\n"
+           "  -B, --binary        The source file is a binary image "
+                                 "without a header\n"
+           "                      rather than a hexdump.  Images written "
+                                 "by \"dcpu16asm\n"
+           "                      --binary\" are recognized "
+                                 "automatically.\n"
            "  -d, --disassemble   Print the instructions that make up "
                                  "the program instead\n"
            "                      of executing it.  Origin offsets, labels"
@@ -181,337 +479,406 @@ void display_help() {
                                  "did not change\n"
            "                      after an instruction\n"
            "                         e.g. loop: SET PC, loop\n"
+           "  -j, --jit           Compile frequently executed code to "
+                                 "native code (x86-64)\n"
+           "  -s, --speed X       Run the CPU at X times its clock rate "
+                                 "of 100 kHz.  Every\n"
+           "                      instruction takes a cycle more than "
+                                 "the spec says\n"
+           "                      (SET takes 2), as the emulator always "
+                                 "counted them\n"
+           "  -T, --turbo         Run the CPU as fast as possible, F2 "
+                                 "toggles this while\n"
+           "                      running\n"
+           "  -f, --fps N         Redraw the screen at most N times per "
+                                 "second (default 60)\n"
+           "  -n, --headless      Run without screen output and at full "
+                                 "speed until halted\n"
+           "                      or a limit is reached, then print the "
+                                 "final state\n"
+           "  -c, --max-cycles N  Stop after N clock cycles\n"
+           "  -i, --max-instructions N\n"
+           "                      Stop after N instructions\n"
+           "  -t, --time-limit S  Stop after S seconds\n"
+           "  -D, --dump START:END\n"
+           "                      Print the RAM from START up to END "
+                                 "after a headless run,\n"
+           "                      may be given more than once\n"
+           "  -S, --save-state FILE\n"
+           "                      Write a snapshot of the machine to FILE "
+                                 "when done\n"
+           "  -R, --restore-state FILE\n"
+           "                      Start from a snapshot instead of "
+                                 "a program\n"
+           "  -r, --record FILE   Log key presses and the cycles they "
+                                 "happened at to FILE\n"
+           "  -p, --replay FILE   Run headless, pressing the keys logged "
+                                 "in FILE at the\n"
+           "                      same cycles again\n"
+           "  -P, --profile FILE  Write the cycles spent per address to "
+                                 "FILE when done\n"
+           "                      (\"-\" for standard output)\n"
+           "  -m, --map FILE      Relate the profile to source lines and "
+                                 "labels using a\n"
+           "                      map written by \"dcpu16asm --map\"\n"
+           "  -x, --trace FILE    Write the last instructions executed to "
+                                 "FILE when done,\n"
+           "                      see dcpu16trace\n"
+           "  -X, --trace-stream FILE\n"
+           "                      Write every instruction executed to "
+                                 "FILE\n"
+           "  -Z, --trace-size N  Keep the last N instructions for "
+                                 "--trace (default 65536)\n"
            "\n"
            "FILENAME is a file containing the bytecode "
            "of the program to emulate.\n"
            "Defaults to standard input if no file is given.\n");
 }
 
-void dcpu16_init(dcpu16 *cpu) {
-    memset(cpu, 0, sizeof(*cpu));
+static void timespec_add(struct timespec *t, long ns) {
+    t->tv_nsec += ns;
+
+    while (t->tv_nsec >= ONE_SECOND) {
+        t->tv_nsec -= ONE_SECOND;
+        t->tv_sec++;
+    }
 }
 
-int dcpu16_get_operand(uint8_t raw, dcpu16operand *op, dcpu16 *cpu) {
-    if (raw < 0x08) {
-        op->type = REGISTER;
-        op->addressing = IMMEDIATE;
-        op->token = raw + T_A;
-    } else if ((raw >= 0x08) && (raw < 0x10)) {
-        op->type = REGISTER;
-        op->addressing = REFERENCE;
-        op->token = (raw % 0x8) + T_A;
-    } else if ((raw >= 0x10) && (raw < 0x18)) {
-        op->type = REGISTER_OFFSET;
-        op->addressing = REFERENCE;
-        op->register_offset.type = LITERAL;
-        op->register_offset.register_index = (raw % 0x8) + T_A;
-        op->register_offset.offset = cpu->ram[cpu->pc++];
-    } else if ((raw >= 0x18) && (raw < 0x20)) {
-        op->addressing = IMMEDIATE;
-        op->type = REGISTER;
-
-        switch (raw) {
-        case 0x18: op->token = T_POP; break;
-        case 0x19: op->token = T_PEEK; break;
-        case 0x1A: op->token = T_PUSH; break;
-        case 0x1B: op->token = T_SP; break;
-        case 0x1C: op->token = T_PC; break;
-        case 0x1D: op->token = T_O; break;
-        case 0x1E: 
-            op->type = LITERAL;
-            op->addressing = REFERENCE;
-            op->numeric = cpu->ram[cpu->pc++];
+static long timespec_diff(struct timespec *a, struct timespec *b) {
+    return (a->tv_sec - b->tv_sec) * ONE_SECOND + (a->tv_nsec - b->tv_nsec);
+}
 
-            break;
+/*
+ * Run the CPU until its cycle counter reaches 'until'.  Returns nonzero if
+ * the CPU halted.
+ */
+static int run_cycles(dcpu16 *cpu, uint64_t until, uint16_t *last_pc) {
+    while (cpu->cycles < until) {
+        if (!cpu->idle) {
+            uint16_t pc = cpu->pc;
+            int n = 1, skipped = cpu->skip_next;
 
-        case 0x1F:
-            op->numeric = cpu->ram[cpu->pc++];
-            op->type = LITERAL;
+            if (flag_jit)
+                n = dcpu16_jit_step(cpu);
+            else
+                dcpu16_step(cpu);
 
-            break;
+            instructions += n;
+
+            if (profile != NULL)
+                profile_count(pc, 1 + cpu->idle, skipped);
+
+            /* A block jumping back to its start is a loop, not a halt */
+            if ((*last_pc == cpu->pc) && (n == 1) && flag_halt)
+                return 1;
+
+            *last_pc = cpu->pc;
+        } else {
+            cpu->idle--;
         }
-    } else if ((raw >= 0x20) && (raw < 0x40)) {
-        op->type = LITERAL;
-        op->addressing = IMMEDIATE;
-        op->numeric = raw - 0x20;
+
+        cpu->cycles++;
     }
 
     return 0;
 }
 
+/*
+ * Runs the CPU on this thread in real time, while the render thread started
+ * here draws the screen and reads the keyboard.
+ */
+void emulate(dcpu16 *cpu) {
+    uint16_t last_pc = 0xFFFF;
+    uint16_t keybuffer = 0;
+    int c;
+    sigset_t winch;
 
-void dcpu16_fetch(dcpu16instruction *instr, dcpu16 *cpu) {
-    uint16_t word = cpu->ram[cpu->pc++];
-    uint16_t inst = word & 0x000F;
-    uint8_t a = (word & 0x03F0) >> 4;
-    uint8_t b = (word & 0xFC00) >> 10;
+    /* Fractions of cycles not yet executed */
+    double credit = 0;
+    struct timespec deadline, now;
 
-    dcpu16operand opa, opb;
+    if (render_start(cpu, fps) < 0) {
+        cleanupgui();
+        fprintf(stderr, "Unable to start render thread -- aborting\n");
+        exit(1);
+    }
 
-    instr->opcode = T_SET + inst - 1;
+    /* Leave resizing the terminal to the render thread */
+    sigemptyset(&winch);
+    sigaddset(&winch, SIGWINCH);
+    pthread_sigmask(SIG_BLOCK, &winch, NULL);
 
-    /* Nonbasic instruction => opcode = a, a = b, b = nothing */
-    if (inst == 0x0) {
-        switch (a) {
-            case 0x01: instr->opcode = T_JSR; break;
-            default:   return;
-        }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
 
-        a = b;
+    for(;;) {
+        uint64_t cycles;
 
-        dcpu16_get_operand(a, &opa, cpu);
+        if ((c = render_getkey()) > 0) {
+            switch (c) {
+            case KEY_LEFT: c = 1; break;
+            case KEY_RIGHT: c = 2; break;
+            case KEY_UP: c = 3; break;
+            case KEY_DOWN: c = 4; break;
 
-        instr->a = opa;
-    } else {
-        dcpu16_get_operand(a, &opa, cpu);
-        dcpu16_get_operand(b, &opb, cpu);
+            case KEY_F(2):
+                flag_turbo = !flag_turbo;
+                c = 0;
 
-        instr->a = opa;
-        instr->b = opb;
-    }
-}
+                break;
+            }
 
-uint16_t load(dcpu16operand *op, dcpu16 *cpu, int *cost) {
-#define TOREG(r) ((r) - T_A)
-    *cost = 0;
-
-    switch (op->type) {
-    case REGISTER:
-        if (op->addressing == IMMEDIATE) {
-            switch (op->token) {
-            case T_POP: return cpu->ram[cpu->sp++]; break;
-            case T_PEEK: return cpu->ram[cpu->sp]; break;
-            case T_PUSH: return cpu->ram[--cpu->sp]; break;
-            case T_SP: return cpu->sp; break;
-            case T_PC: return cpu->pc; break;
-            case T_O: return cpu->o; break;
-            default: return cpu->registers[TOREG(op->token)];
+            /*
+             * This is actually wrong per observation, the actual
+             * keyboard buffer is a 16 word ringbuffer, not a
+             * single memory location.  This is a compatibility
+             * decission.
+             */
+            if (c > 0) {
+                dcpu16_poke(cpu, KEYBOARD + (keybuffer++ % 0x1), c);
+
+                if (record != NULL)
+                    fprintf(record, "%llu %d\n",
+                            (unsigned long long)cpu->cycles, c);
             }
+        }
+
+        if (flag_turbo) {
+            cycles = TURBO_SLICE;
         } else {
-            return cpu->ram[cpu->registers[TOREG(op->token)]];
+            credit += (double)CLOCKRATE * speed * SLICE / ONE_SECOND;
+            cycles = (uint64_t)credit;
+            credit -= cycles;
         }
 
-    case REGISTER_OFFSET:
-        *cost = 1;
-        return cpu->ram[cpu->registers[TOREG(op->register_offset.register_index)]
-                       + op->register_offset.offset];
+        if (run_cycles(cpu, cpu->cycles + cycles, &last_pc) || interrupted)
+            break;
 
-    case LITERAL:
-        if (op->addressing == IMMEDIATE) {
-            if (op->numeric > 0x1f)
-                *cost = 1;
+        render_publish(cpu, speed, flag_turbo);
 
-            return op->numeric;
-        } else {
-            *cost = 1;
-            return cpu->ram[op->numeric];
+        /*
+         * Sleep until the end of this slice.  Deadlines are absolute, so
+         * oversleeping in one slice is made up for in the next ones.
+         */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (flag_turbo) {
+            deadline = now;
+            continue;
         }
 
-    default: break;
+        timespec_add(&deadline, SLICE);
+
+        if (timespec_diff(&now, &deadline) > MAX_LAG)
+            deadline = now;
+        else
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                   &deadline, NULL) == EINTR)
+                continue;
     }
 
-    return 0;
-#undef TOREG
+    render_publish(cpu, speed, flag_turbo);
+    render_stop();
 }
 
-void store(dcpu16operand *op, uint16_t val, dcpu16 *cpu) {
-#define TOREG(r) ((r) - T_A)
-    switch (op->type) {
-    case REGISTER:
-        if (op->addressing == IMMEDIATE) {
-                switch (op->token) {
-                case T_POP: cpu->ram[cpu->sp++] = val; break;
-                case T_PEEK: cpu->ram[cpu->sp] = val; break;
-                case T_PUSH: cpu->ram[--cpu->sp] = val; break;
-                case T_SP: cpu->sp = val; break;
-                case T_PC: cpu->pc = val; break;
-                case T_O: cpu->o = val; break;
-                default: cpu->registers[TOREG(op->token)] = val;
-                }
-        } else {
-            cpu->ram[cpu->registers[TOREG(op->token)]] = val;
-        }
+static double elapsed(struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-        break;
+    return (now.tv_sec - since->tv_sec)
+         + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
 
-    case REGISTER_OFFSET:
-        cpu->ram[cpu->registers[TOREG(op->register_offset.register_index)]
-               + op->register_offset.offset] = val;
-        break;
+/*
+ * Whether a compiled block could run past --max-cycles or --max-instructions.
+ * Blocks run as a whole, so the last instructions before a limit are
+ * interpreted one by one to stop right at it.
+ */
+static int near_limit(dcpu16 *cpu) {
+    return (max_cycles && (cpu->cycles + JIT_MAXCYCLES >= max_cycles))
+        || (max_instructions
+            && (instructions + JIT_MAXINSTR + 1 >= max_instructions));
+}
 
-    case LITERAL:
-        if (op->addressing == IMMEDIATE)
-            ; /* Skip but don't complain */
-        else
-            cpu->ram[op->numeric] = val;
+/*
+ * Like emulate(), but without input, screen output or sleeping.  Idle cycles
+ * are accounted for in one go instead of spinning through them.
+ */
+void emulate_headless(dcpu16 *cpu) {
+    struct timespec start;
+    const char *reason = NULL;
+    unsigned long steps = 0;
+    int key = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (reason == NULL) {
+        uint16_t pc = cpu->pc;
+        int n = 1, skipped = cpu->skip_next;
+
+        /* Keys are seen by the first instruction starting at or after the
+         * cycle they were pressed at, just like in emulate() */
+        while ((key < nreplay) && (cpu->cycles >= replay[key].cycle))
+            dcpu16_poke(cpu, KEYBOARD, replay[key++].code);
 
-        break;
+        if (flag_jit && !near_limit(cpu))
+            n = dcpu16_jit_step(cpu);
+        else
+            dcpu16_step(cpu);
 
-    default: break;
+        instructions += n;
+
+        if (profile != NULL)
+            profile_count(pc, 1 + cpu->idle, skipped);
+
+        cpu->cycles += 1 + cpu->idle;
+        cpu->idle = 0;
+
+        /* A block jumping back to its start is a loop, not a halt */
+        if (flag_halt && (pc == cpu->pc) && (n == 1))
+            reason = "halted";
+        else if (max_cycles && (cpu->cycles >= max_cycles))
+            reason = "cycle limit reached";
+        else if (max_instructions && (instructions >= max_instructions))
+            reason = "instruction limit reached";
+        else if ((time_limit > 0) && !(++steps & 0xFFFF)
+                                  && (elapsed(&start) >= time_limit))
+            reason = "time limit reached";
+        else if (interrupted)
+            reason = "interrupted";
     }
 
-    return;
-#undef TOREG
+    printf("Stopped (%s) after %llu instructions, %llu cycles, %.3fs\n",
+            reason, (unsigned long long)instructions,
+            (unsigned long long)cpu->cycles, elapsed(&start));
+
+    dump_state(cpu);
 }
 
-void dcpu16_execute(dcpu16instruction *instr, dcpu16 *cpu) {
-    /* If any instruction tries to set a literal value, fail silently */
-    uint16_t result;
-    int costa, costb, costi;
-    uint16_t a = load(&(instr->a), cpu, &costa),
-             b = load(&(instr->b), cpu, &costb);
-
-    switch (instr->opcode) {
-    case T_JSR:
-        cpu->ram[--cpu->sp] = cpu->pc;
-        cpu->pc = a;
-        break;
-
-    case T_SET:
-        result = b;
-        costi = 1;
-        break;
-
-    case T_ADD:
-        result = a + b;
-        cpu->o = ((result < a) || (result < b));
-        costi = 2;
-        break;
-
-    case T_SUB:
-        result = a - b;
-        cpu->o = (result > a) ? 0xFFFF : 0;
-        costi = 2;
-        break;
-
-    case T_MUL:
-        result = a * b;
-        cpu->o = (result >> 16) & 0xFFFF;
-        costi = 2;
-        break;
-
-    case T_DIV:
-        if (b != 0) {
-            result = a / b;
-            cpu->o = ((a << 16) / b) & 0xFFFF;
-        } else {
-            result = 0;
-            cpu->o = 0;
-        }
+/*
+ * Prints the program as instructions, up to the last nonzero word
+ */
+void disassemble_program(dcpu16 *cpu) {
+    uint16_t words[3];
+    uint32_t addr = 0, end = RAMSIZE;
+    char buf[64];
+    int i, length;
+
+    while ((end > 0) && !cpu->ram[end - 1])
+        end--;
 
-        costi = 3;
-
-        break;
-
-    case T_MOD:
-        result = (b != 0) ? (a % b) : 0;
-        costi = 3;
-        break;
-
-    case T_SHL:
-        result = a << b;
-        cpu->o = ((a << b) >> 16) & 0xFFFF;
-        costi = 2;
-        break;
-
-    case T_SHR:
-        result = a >> b;
-        cpu->o = ((a << 16) >> b) & 0xFFFF;
-        costi = 2;
-        break;
-
-    case T_AND:
-        result = a & b;
-        costi = 1;
-        break;
-
-    case T_BOR:
-        result = a | b;
-        costi = 1;
-        break;
-
-    case T_XOR:
-        result = a ^ b;
-        costi = 1;
-        break;
-
-    case T_IFE:
-        cpu->skip_next = !(a == b);
-        costi = 2 + cpu->skip_next;
-        break;
-
-    case T_IFN:
-        cpu->skip_next =  (a == b);
-        costi = 2 + cpu->skip_next;
-        break;
-
-    case T_IFG:
-        cpu->skip_next = !(a > b);
-        costi = 2 + cpu->skip_next;
-        break;
-    case T_IFB:
-        cpu->skip_next =  (a & b) == 0;
-        costi = 2 + cpu->skip_next;
-        break;
-
-    default: return;
+    while (addr < end) {
+        for (i = 0; i < 3; ++i)
+            words[i] = cpu->ram[(uint16_t)(addr + i)];
+
+        length = disassemble(words, buf, sizeof(buf));
+        printf("%04X: %s\n", addr, buf);
+
+        addr += length;
     }
+}
+
+void dump_state(dcpu16 *cpu) {
+    static const char names[] = "ABCXYZIJ";
+    int i;
+    uint32_t addr;
+
+    printf("PC: %04X  SP: %04X  O: %04X\n", cpu->pc, cpu->sp, cpu->o);
+
+    for (i = 0; i < 8; ++i)
+        printf("%c: %04X%s", names[i], cpu->registers[i],
+                (i % 4 == 3) ? "\n" : "  ");
+
+    for (i = 0; i < ndumps; ++i) {
+        printf("\n");
 
-    cpu->idle = costa + costb + costi;
+        for (addr = dumps[i].start; addr < dumps[i].end; ++addr) {
+            if ((addr == dumps[i].start) || !(addr % 8))
+                printf("%04X:", addr);
 
-    if (!is_nonbasic_instruction(instr->opcode) && 
-        ((instr->opcode >= T_SET) && (instr->opcode <= T_XOR)))
-            store(&(instr->a), result, cpu);
+            printf(" %04X", cpu->ram[addr]);
+
+            if (((addr + 1) % 8 == 0) || (addr + 1 == dumps[i].end))
+                printf("\n");
+        }
+    }
 }
 
-void dcpu16_step(dcpu16 *cpu) {
-    dcpu16instruction instr = {0};
+int parse_range(const char *s) {
+    char *end;
+    unsigned long start, stop;
 
-    dcpu16_fetch(&instr, cpu);
+    if (ndumps >= MAXDUMPS)
+        return -1;
 
-    if (!cpu->skip_next)
-        dcpu16_execute(&instr, cpu);
-    else
-        cpu->skip_next = cpu->idle = 0;
+    start = strtoul(s, &end, 0);
+    if ((end == s) || (*end++ != ':'))
+        return -1;
 
+    stop = strtoul(end, &end, 0);
+    if (*end || (start >= stop) || (stop > RAMSIZE))
+        return -1;
+
+    dumps[ndumps].start = start;
+    dumps[ndumps].end = stop;
+    ndumps++;
+
+    return 0;
 }
 
-void emulate(dcpu16 *cpu) {
-    uint16_t last_pc = 0xFFFF;
-    uint16_t keybuffer = 0;
-    int c;
+/*
+ * Reads a decimal, hexadecimal or octal count, such as a limit of cycles or
+ * instructions (0 meaning none) or the size of the trace
+ */
+int parse_count(const char *s, uint64_t *n) {
+    char *end;
 
-    for(;;) {
-        if ((c = getch()) > 0) {
-            switch (c) {
-            case KEY_LEFT: c = 1; break;
-            case KEY_RIGHT: c = 2; break;
-            case KEY_UP: c = 3; break;
-            case KEY_DOWN: c = 4; break;
-            }
+    if (!isdigit((unsigned char)*s))
+        return -1;
 
-            /*
-             * This is actually wrong per observation, the actual
-             * keyboard buffer is a 16 word ringbuffer, not a
-             * single memory location.  This is a compatibility
-             * decission.
-             */
-            cpu->ram[0x9000 + (keybuffer++ % 0x1)] = c;
-        }
+    errno = 0;
+    *n = strtoull(s, &end, 0);
 
-        if (!cpu->idle) {
-            dcpu16_step(cpu);
-            updategui(cpu);
+    return (*end || (errno == ERANGE)) ? -1 : 0;
+}
 
-            if ((last_pc == cpu->pc) && flag_halt)
-                break;
+/*
+ * Reads a key log written by --record, one "CYCLE CODE" pair per line
+ */
+int read_replay(const char *fname) {
+    FILE *f = fopen(fname, "r");
+    unsigned long long cycle;
+    int code, size = 0;
+
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open '%s' -- aborting\n", fname);
+        return -1;
+    }
 
-            last_pc = cpu->pc;
-        } else {
-            cpu->idle--;
-            fprintf(stderr, "IDLE, EXECUTING BEFORE %04X\n", cpu->pc);
+    while (fscanf(f, "%llu %i", &cycle, &code) == 2) {
+        if (nreplay == size) {
+            size = size ? size * 2 : 64;
+
+            if ((replay = realloc(replay, size * sizeof(*replay))) == NULL) {
+                fprintf(stderr, "Out of memory -- aborting\n");
+                fclose(f);
+                return -1;
+            }
         }
 
-        _usleep(10);
+        if (nreplay && (cycle < replay[nreplay - 1].cycle))
+            break;
+
+        replay[nreplay].cycle = cycle;
+        replay[nreplay++].code = code;
+    }
+
+    if (!feof(f)) {
+        fprintf(stderr, "%s: Invalid key log -- aborting\n", fname);
+        fclose(f);
+        return -1;
     }
+
+    fclose(f);
+
+    return 0;
 }
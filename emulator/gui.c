@@ -1,19 +1,30 @@
 #include <signal.h>
 #include <ctype.h>
 #include <ncurses.h>
+#include <string.h>
 
 #include "gui.h"
 #include "../common/types.h"
 
-void updatescreen(dcpu16*);
-void updatestatus(dcpu16*);
+WINDOW *status;
+WINDOW *cpuscreen;
+
+void updatescreen(dcpu16screen*);
+void updatestatus(dcpu16screen*);
+void updateclock(dcpu16screen*);
 void handleresize(int sig);
 
+/* Set if everything has to be drawn again, not only what changed */
+static volatile int redraw_all = 1;
+
 
 void handleresize(int sig) {
+    (void)sig;
+
     wresize(stdscr, LINES, COLS);
 
     clear();
+    redraw_all = 1;
 }
 
 void initgui() {
@@ -79,53 +90,114 @@ void cleanupgui() {
     endwin();
 }
 
-void updategui(dcpu16 *cpu) {
-    mvprintw(0, 0, "dcpu16emu");
-    mvhline(1, 0, ACS_BULLET, 10);
+/*
+ * Draws whatever changed since the last call and updates the terminal in one
+ * go.
+ */
+void updategui(dcpu16screen *screen) {
+    if (redraw_all) {
+        mvprintw(0, 0, "dcpu16emu");
+        mvhline(1, 0, ACS_BULLET, 10);
+        wnoutrefresh(stdscr);
+
+        box(cpuscreen, 0, 0);
+        mvwprintw(cpuscreen, 0, 2, " Screen ");
+        touchwin(cpuscreen);
+
+        box(status, 0, 0);
+        mvwprintw(status, 0, 2, " CPU ");
+        touchwin(status);
+    }
+
+    updatescreen(screen);
+    updatestatus(screen);
+    updateclock(screen);
 
+    redraw_all = 0;
 
-    updatescreen(cpu);
-    updatestatus(cpu);
+    doupdate();
 }
 
-void updatestatus(dcpu16 *cpu) {
+void updateclock(dcpu16screen *screen) {
+    static double shown_speed = 0;
+    static int shown_turbo = -1;
+
+    if (!redraw_all && (shown_speed == screen->speed)
+                    && (shown_turbo == screen->turbo))
+        return;
+
+    shown_speed = screen->speed;
+    shown_turbo = screen->turbo;
+
+    if (screen->turbo)
+        mvwprintw(status, 12, 2, "Clock: turbo");
+    else
+        mvwprintw(status, 12, 2, "Clock: %.0f kHz", screen->speed * 100);
+
+    wclrtoeol(status);
     box(status, 0, 0);
     mvwprintw(status, 0, 2, " CPU ");
 
-    mvwprintw(status, 1, 2, "PC: %04X    SP: %04X", cpu->pc, cpu->sp);
-    mvwprintw(status, 2, 2, " O: %04X", cpu->o);
+    wnoutrefresh(status);
+}
+
+/*
+ * Only touches the window if any of the values shown changed
+ */
+void updatestatus(dcpu16screen *screen) {
+    static uint16_t shown[11];
+    uint16_t current[11];
+
+    current[0] = screen->pc;
+    current[1] = screen->sp;
+    current[2] = screen->o;
+    memcpy(current + 3, screen->registers, sizeof(screen->registers));
+
+    if (!redraw_all && !memcmp(shown, current, sizeof(current)))
+        return;
 
-    mvwprintw(status, 4, 2, "A: %04X", cpu->registers[0]);
-    mvwprintw(status, 5, 2, "B: %04X", cpu->registers[1]);
-    mvwprintw(status, 6, 2, "C: %04X", cpu->registers[2]);
-    mvwprintw(status, 7, 2, "X: %04X", cpu->registers[3]);
-    mvwprintw(status, 8, 2, "Y: %04X", cpu->registers[4]);
-    mvwprintw(status, 9, 2, "Z: %04X", cpu->registers[5]);
-    mvwprintw(status, 10, 2, "I: %04X", cpu->registers[6]);
-    mvwprintw(status, 11, 2, "J: %04X", cpu->registers[7]);
+    memcpy(shown, current, sizeof(current));
 
-    wrefresh(status);
+    mvwprintw(status, 1, 2, "PC: %04X    SP: %04X", screen->pc, screen->sp);
+    mvwprintw(status, 2, 2, " O: %04X", screen->o);
+
+    mvwprintw(status, 4, 2, "A: %04X", screen->registers[0]);
+    mvwprintw(status, 5, 2, "B: %04X", screen->registers[1]);
+    mvwprintw(status, 6, 2, "C: %04X", screen->registers[2]);
+    mvwprintw(status, 7, 2, "X: %04X", screen->registers[3]);
+    mvwprintw(status, 8, 2, "Y: %04X", screen->registers[4]);
+    mvwprintw(status, 9, 2, "Z: %04X", screen->registers[5]);
+    mvwprintw(status, 10, 2, "I: %04X", screen->registers[6]);
+    mvwprintw(status, 11, 2, "J: %04X", screen->registers[7]);
+
+    wnoutrefresh(status);
 }
 
 
-void updatescreen(dcpu16 *cpu) {
+/*
+ * Only draws the cells that changed since the last call
+ */
+void updatescreen(dcpu16screen *screen) {
+    static uint16_t shown[VRAMWIDTH * VRAMHEIGHT];
     uint16_t x, y;
-    uint16_t *vram = cpu->ram + 0x8000;
 
-    box(cpuscreen, 0, 0);
-    mvwprintw(cpuscreen, 0, 2, " Screen ");
+    for (y = 0; y < VRAMHEIGHT; ++y) {
+        for (x = 0; x < VRAMWIDTH; ++x) {
+            uint16_t word = screen->vram[y * VRAMWIDTH + x];
+            char asciival;
+            uint8_t fg, bg;
+            int id;
 
-    for (x = 0; x < 32; ++x) {
-        for (y = 0; y < 12; ++y) {
-            uint16_t word = vram[y * 32 + x];
-            char asciival = word & 0x7F;
+            if (!redraw_all && (shown[y * VRAMWIDTH + x] == word))
+                continue;
 
-            uint8_t fg = (word & 0xF000) >> 12;
-            uint8_t bg = (word & 0x0F00) >> 8;
-            int id = ((fg << 4) | bg) + 16;
+            shown[y * VRAMWIDTH + x] = word;
+            asciival = word & 0x7F;
+
+            fg = (word & 0xF000) >> 12;
+            bg = (word & 0x0F00) >> 8;
+            id = ((fg << 4) | bg) + 16;
 
-            /* Do something with fb and bg... */
-            wmove(cpuscreen, y + 1, x + 1);
             if (isprint(asciival)) {
                 mvwaddch(cpuscreen, y+1, x+1, asciival | COLOR_PAIR(id));
             } else {
@@ -134,5 +206,5 @@ void updatescreen(dcpu16 *cpu) {
         }
     }
 
-    wrefresh(cpuscreen);
+    wnoutrefresh(cpuscreen);
 }
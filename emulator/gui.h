@@ -4,12 +4,26 @@
 #include "../common/types.h"
 
 
-WINDOW *status;
-WINDOW *cpuscreen;
+/*
+ * Everything the GUI shows, copied out of the CPU by the emulation thread
+ */
+typedef struct {
+    uint16_t registers[8];
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t o;
+    uint16_t vram[VRAMWIDTH * VRAMHEIGHT];
+
+    double speed;
+    int turbo;
+} dcpu16screen;
+
+extern WINDOW *status;
+extern WINDOW *cpuscreen;
 
 void initgui();
 void cleanupgui();
 
-void updategui(dcpu16*);
+void updategui(dcpu16screen*);
 
 #endif
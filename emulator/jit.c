@@ -0,0 +1,813 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Basic block compiler to x86-64.
+ *
+ * Every address that is reached by a jump is counted, and once it was
+ * reached JIT_THRESHOLD times, the straight-line run of instructions starting
+ * there is translated into native code.  A block ends after an instruction
+ * writing PC, a JSR, or an IF* and the instruction following it: the two are
+ * compiled together, with the second one jumped over if the condition fails,
+ * and both paths leave the block.  If nothing follows the IF* within the
+ * block the skip is left to the interpreter.
+ *
+ * The first JIT_NSLOTS registers, SP or O a block uses are kept in callee
+ * saved host registers from its entry to its exits; the rest, and PC, are
+ * read and written in the dcpu16 struct, whose address is kept in rbx.  As
+ * slots are handed out while compiling, the entry loading them is emitted
+ * after the block and jumps back to its start.  Every exit stores the slots
+ * back, so the struct is up to date whenever the interpreter or the GUI get
+ * to see it.  RAM writes go through dcpu16_poke() so the instruction cache,
+ * and the blocks themselves, are invalidated as usual.  If a block overwrites
+ * its own code it leaves right after the offending instruction.
+ *
+ * Each block sets 'idle' so that it takes exactly as many calls to emulate()'s
+ * main loop as interpreting its instructions one by one would have.
+ *
+ * Each CPU compiles into its own code buffer, see cpu->jit.  The address and
+ * guest PC of every block is written to /tmp/perf-<pid>.map so perf(1) can
+ * attribute samples to generated code.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jit.h"
+#include "cpu.h"
+#include "../common/types.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+#define JIT_THRESHOLD   32
+#define JIT_CODESIZE    (16 * 1024 * 1024)
+
+/* Words a block may span, JIT_MAXINSTR instructions and the one following a
+ * final IF* */
+#define JIT_MAXWORDS    ((JIT_MAXINSTR + 1) * 3)
+
+/* Worst case size of the code generated for a single block */
+#define JIT_MAXCODE     ((JIT_MAXINSTR + 1) * 384 + 512)
+
+/* Marks addresses that failed to compile */
+#define JIT_FAILED      0xFF
+
+/* Guest values a host register can be set aside for: A to J, SP and O */
+#define V_SP            8
+#define V_O             9
+#define NVALUES         10
+
+#define JIT_NSLOTS      5
+
+typedef int (*jitcode)(dcpu16*);
+
+typedef struct {
+    jitcode code;
+    uint16_t end;  /* First address after the block */
+} jitblock;
+
+typedef struct dcpu16jit {
+    jitblock blocks[RAMSIZE];
+    uint8_t hits[RAMSIZE];
+    uint8_t covered[RAMSIZE];  /* Number of blocks covering an address */
+
+    jitblock *running;
+    int running_killed;
+    int at_leader;
+
+    uint8_t *code;
+    uint8_t *code_ptr;
+    FILE *perfmap;
+
+    /* Host register holding each guest value in the block being compiled,
+     * -1 if none */
+    int slot[NVALUES];
+    int nslots;
+} dcpu16jit;
+
+/*
+ * Offsets into the dcpu16 struct
+ */
+#define OFF_REG(r)   (offsetof(dcpu16, registers) + 2 * (r))
+#define OFF_RAM(a)   (offsetof(dcpu16, ram) + 2 * (a))
+#define OFF_PC       offsetof(dcpu16, pc)
+#define OFF_SP       offsetof(dcpu16, sp)
+#define OFF_O        offsetof(dcpu16, o)
+#define OFF_SKIP     offsetof(dcpu16, skip_next)
+#define OFF_IDLE     offsetof(dcpu16, idle)
+
+/*
+ * Host registers.  eax, ecx, edx, esi and edi are scratch, the callee saved
+ * ones in 'slots' hold guest values.
+ */
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define EBP 5
+#define ESI 6
+#define EDI 7
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+static const int slots[JIT_NSLOTS] = { EBP, R12, R13, R14, R15 };
+
+/* Operand fields using a next word and their cost, see threaded.c */
+#define USES_NEXT_WORD(o) ((((o) >= 0x10) && ((o) < 0x18)) \
+                           || ((o) == 0x1e) || ((o) == 0x1f))
+#define NEXT_WORD_COST(o, nw) (((o) == 0x1f) ? ((nw) > 0x1f) \
+                                              : USES_NEXT_WORD(o))
+
+
+static void emit8(dcpu16jit *j, uint8_t b) {
+    *j->code_ptr++ = b;
+}
+
+static void emit16(dcpu16jit *j, uint16_t w) {
+    memcpy(j->code_ptr, &w, sizeof(w));
+    j->code_ptr += sizeof(w);
+}
+
+static void emit32(dcpu16jit *j, uint32_t d) {
+    memcpy(j->code_ptr, &d, sizeof(d));
+    j->code_ptr += sizeof(d);
+}
+
+static void emit64(dcpu16jit *j, uint64_t q) {
+    memcpy(j->code_ptr, &q, sizeof(q));
+    j->code_ptr += sizeof(q);
+}
+
+/* REX prefix needed for 'reg' in the reg field and 'rm' in the r/m field */
+static void emit_rex(dcpu16jit *j, int reg, int rm) {
+    if ((reg | rm) & 8)
+        emit8(j, 0x40 | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+}
+
+/* movzx r32, word [rbx + disp32] */
+static void emit_load16(dcpu16jit *j, int r, uint32_t disp) {
+    emit_rex(j, r, 0);
+    emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0x83 | ((r & 7) << 3));
+    emit32(j, disp);
+}
+
+/* movzx r32, word [rbx + rsi * 2 + disp32] */
+static void emit_load16_ram(dcpu16jit *j, int r) {
+    emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0x84 | (r << 3)); emit8(j, 0x73);
+    emit32(j, OFF_RAM(0));
+}
+
+/* mov word [rbx + disp32], r16 */
+static void emit_store16(dcpu16jit *j, int r, uint32_t disp) {
+    emit8(j, 0x66);
+    emit_rex(j, r, 0);
+    emit8(j, 0x89); emit8(j, 0x83 | ((r & 7) << 3));
+    emit32(j, disp);
+}
+
+/* mov word [rbx + disp32], imm16 */
+static void emit_store16_imm(dcpu16jit *j, uint32_t disp, uint16_t imm) {
+    emit8(j, 0x66); emit8(j, 0xC7); emit8(j, 0x83);
+    emit32(j, disp); emit16(j, imm);
+}
+
+/* mov r32, imm32 */
+static void emit_mov_imm(dcpu16jit *j, int r, uint32_t imm) {
+    emit8(j, 0xB8 + r); emit32(j, imm);
+}
+
+/* op r/m32, r32 (reg-reg form, 0x89 mov, 0x01 add, 0x29 sub, ...) */
+static void emit_rr(dcpu16jit *j, uint8_t op, int dst, int src) {
+    emit_rex(j, src, dst);
+    emit8(j, op); emit8(j, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+/* movzx r32, r16 */
+static void emit_movzx(dcpu16jit *j, int dst, int src) {
+    emit_rex(j, dst, src);
+    emit8(j, 0x0F); emit8(j, 0xB7);
+    emit8(j, 0xC0 | ((dst & 7) << 3) | (src & 7));
+}
+
+/* call a C function with the dcpu16 in the first argument */
+static void emit_call(dcpu16jit *j, void *fn) {
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xDF);   /* mov rdi, rbx */
+    emit8(j, 0x48); emit8(j, 0xB8);                   /* mov rax, imm64 */
+    emit64(j, (uintptr_t)fn);
+    emit8(j, 0xFF); emit8(j, 0xD0);                   /* call rax */
+}
+
+static uint32_t value_offset(int v) {
+    if (v == V_SP)
+        return OFF_SP;
+    else if (v == V_O)
+        return OFF_O;
+    else
+        return OFF_REG(v);
+}
+
+/*
+ * Host register holding guest value 'v', handing out a free one the first
+ * time it is used.  Returns -1 if it stays in the dcpu16 struct.
+ */
+static int slot_of(dcpu16jit *j, int v) {
+    if ((j->slot[v] < 0) && (j->nslots < JIT_NSLOTS))
+        j->slot[v] = slots[j->nslots++];
+
+    return j->slot[v];
+}
+
+/* r = guest value 'v' */
+static void emit_get(dcpu16jit *j, int r, int v) {
+    int s = slot_of(j, v);
+
+    if (s >= 0)
+        emit_rr(j, 0x89, r, s);
+    else
+        emit_load16(j, r, value_offset(v));
+}
+
+/* Guest value 'v' = the lower half of r */
+static void emit_put(dcpu16jit *j, int v, int r) {
+    int s = slot_of(j, v);
+
+    if (s >= 0)
+        emit_movzx(j, s, r);
+    else
+        emit_store16(j, r, value_offset(v));
+}
+
+/*
+ * Set up the stack frame and the slots handed out, then continue at 'body'
+ */
+static void emit_entry(dcpu16jit *j, uint8_t *body) {
+    int v;
+
+    emit8(j, 0x53);                                   /* push rbx */
+    emit8(j, 0x55);                                   /* push rbp */
+    emit8(j, 0x41); emit8(j, 0x54);                   /* push r12 */
+    emit8(j, 0x41); emit8(j, 0x55);                   /* push r13 */
+    emit8(j, 0x41); emit8(j, 0x56);                   /* push r14 */
+    emit8(j, 0x41); emit8(j, 0x57);                   /* push r15 */
+    emit8(j, 0x48); emit8(j, 0x83); emit8(j, 0xEC);   /* sub rsp, 8 */
+    emit8(j, 0x08);
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xFB);   /* mov rbx, rdi */
+
+    emit8(j, 0xC7); emit8(j, 0x83); emit32(j, OFF_IDLE); /* mov [idle], 0 */
+    emit32(j, 0);
+
+    for (v = 0; v < NVALUES; ++v)
+        if (j->slot[v] >= 0)
+            emit_load16(j, j->slot[v], value_offset(v));
+
+    emit8(j, 0xE9); emit32(j, 0);                     /* jmp rel32 */
+    *(int32_t *)(j->code_ptr - 4) = body - j->code_ptr;
+}
+
+/*
+ * Leave the block after 'count' instructions having cost 'cost' cycles on
+ * top of the skips already added to idle.  'pc' < 0 leaves PC alone.
+ */
+static void emit_exit(dcpu16jit *j, int32_t pc, int cost, int count) {
+    int v;
+
+    for (v = 0; v < NVALUES; ++v)
+        if (j->slot[v] >= 0)
+            emit_store16(j, j->slot[v], value_offset(v));
+
+    if (pc >= 0)
+        emit_store16_imm(j, OFF_PC, pc);
+
+    emit8(j, 0x81); emit8(j, 0x83); emit32(j, OFF_IDLE); /* add [idle], */
+    emit32(j, cost + count - 1);                         /* imm32 */
+    emit_mov_imm(j, EAX, count);
+
+    emit8(j, 0x48); emit8(j, 0x83); emit8(j, 0xC4);   /* add rsp, 8 */
+    emit8(j, 0x08);
+    emit8(j, 0x41); emit8(j, 0x5F);                   /* pop r15 */
+    emit8(j, 0x41); emit8(j, 0x5E);                   /* pop r14 */
+    emit8(j, 0x41); emit8(j, 0x5D);                   /* pop r13 */
+    emit8(j, 0x41); emit8(j, 0x5C);                   /* pop r12 */
+    emit8(j, 0x5D);                                   /* pop rbp */
+    emit8(j, 0x5B);                                   /* pop rbx */
+    emit8(j, 0xC3);                                   /* ret */
+}
+
+/*
+ * esi = RAM address [register + next word]
+ */
+static void emit_offset_address(dcpu16jit *j, int reg, uint16_t nw) {
+    emit_get(j, ESI, reg);
+    emit8(j, 0x81); emit8(j, 0xC6); emit32(j, nw);    /* add esi, imm32 */
+    emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0xF6);   /* movzx esi, si */
+}
+
+/* esi = SP++ */
+static void emit_pop_address(dcpu16jit *j) {
+    emit_get(j, ESI, V_SP);
+    emit8(j, 0x8D); emit8(j, 0x7E); emit8(j, 0x01);   /* lea edi, [rsi+1] */
+    emit_put(j, V_SP, EDI);
+}
+
+/* esi = --SP */
+static void emit_push_address(dcpu16jit *j) {
+    emit_get(j, ESI, V_SP);
+    emit8(j, 0x8D); emit8(j, 0x76); emit8(j, 0xFF);   /* lea esi, [rsi-1] */
+    emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0xF6);   /* movzx esi, si */
+    emit_put(j, V_SP, ESI);
+}
+
+/*
+ * Load an operand into r (eax or ecx), with all of its side effects
+ */
+static void emit_operand_load(dcpu16jit *j, int r, uint8_t field,
+                              uint16_t nw, uint16_t pc) {
+    if (field < 0x08) {
+        emit_get(j, r, field);
+    } else if (field < 0x10) {
+        emit_get(j, ESI, field - 0x08);
+        emit_load16_ram(j, r);
+    } else if (field < 0x18) {
+        emit_offset_address(j, field - 0x10, nw);
+        emit_load16_ram(j, r);
+    } else {
+        switch (field) {
+        case 0x18: /* POP */
+            emit_pop_address(j);
+            emit_load16_ram(j, r);
+            break;
+
+        case 0x19: /* PEEK */
+            emit_get(j, ESI, V_SP);
+            emit_load16_ram(j, r);
+            break;
+
+        case 0x1A: /* PUSH */
+            emit_push_address(j);
+            emit_load16_ram(j, r);
+            break;
+
+        case 0x1B: emit_get(j, r, V_SP); break;
+        case 0x1C: emit_mov_imm(j, r, pc); break;
+        case 0x1D: emit_get(j, r, V_O); break;
+        case 0x1E: emit_load16(j, r, OFF_RAM(nw)); break;
+        case 0x1F: emit_mov_imm(j, r, nw); break;
+        default:   emit_mov_imm(j, r, field - 0x20); break;
+        }
+    }
+}
+
+/*
+ * Resolve a RAM operand into esi for storing, with all of its side effects.
+ * Returns 0 if the operand does not refer to RAM.
+ */
+static int emit_operand_address(dcpu16jit *j, uint8_t field, uint16_t nw) {
+    if (field < 0x08) {
+        return 0;
+    } else if (field < 0x10) {
+        emit_get(j, ESI, field - 0x08);
+    } else if (field < 0x18) {
+        emit_offset_address(j, field - 0x10, nw);
+    } else {
+        switch (field) {
+        case 0x18: emit_pop_address(j); break;
+        case 0x19: emit_get(j, ESI, V_SP); break;
+        case 0x1A: emit_push_address(j); break;
+        case 0x1E: emit_mov_imm(j, ESI, nw); break;
+        default:   return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Helpers called from generated code.  Those setting O return it in the
+ * upper half, as it may be kept in a host register.
+ */
+static int jit_store(dcpu16 *cpu, uint32_t addr, uint32_t val) {
+    dcpu16_poke(cpu, addr, val);
+    return cpu->jit->running_killed;
+}
+
+static uint32_t jit_div(dcpu16 *cpu, uint16_t a, uint16_t b) {
+    (void)cpu;
+
+    if (b == 0)
+        return 0;
+
+    return (uint16_t)(a / b) | ((uint32_t)(((a << 16) / b) & 0xFFFF) << 16);
+}
+
+static uint32_t jit_mod(dcpu16 *cpu, uint16_t a, uint16_t b) {
+    (void)cpu;
+
+    return (b != 0) ? (a % b) : 0;
+}
+
+static uint32_t jit_shl(dcpu16 *cpu, uint16_t a, uint16_t b) {
+    (void)cpu;
+
+    return (uint16_t)(a << b) | ((uint32_t)(((a << b) >> 16) & 0xFFFF) << 16);
+}
+
+static uint32_t jit_shr(dcpu16 *cpu, uint16_t a, uint16_t b) {
+    (void)cpu;
+
+    return (uint16_t)(a >> b) | ((uint32_t)(((a << 16) >> b) & 0xFFFF) << 16);
+}
+
+/* eax = fn(cpu, eax, ecx), setting O from the upper half if 'sets_o' */
+static void emit_helper(dcpu16jit *j, void *fn, int sets_o) {
+    emit_rr(j, 0x89, ESI, EAX);                       /* mov esi, eax */
+    emit_rr(j, 0x89, EDX, ECX);                       /* mov edx, ecx */
+    emit_call(j, fn);
+
+    if (sets_o) {
+        emit_rr(j, 0x89, EDX, EAX);                   /* mov edx, eax */
+        emit8(j, 0xC1); emit8(j, 0xEA); emit8(j, 0x10); /* shr edx, 16 */
+        emit_put(j, V_O, EDX);
+    }
+
+    emit_movzx(j, EAX, EAX);
+}
+
+/* Guest O = the upper half of eax, after ADD, SUB and MUL */
+static void emit_overflow(dcpu16jit *j) {
+    emit_rr(j, 0x89, EDX, EAX);                       /* mov edx, eax */
+    emit8(j, 0xC1); emit8(j, 0xEA); emit8(j, 0x10);   /* shr edx, 16 */
+    emit_put(j, V_O, EDX);
+}
+
+static void flush(dcpu16jit *j) {
+    memset(j->blocks, 0, sizeof(j->blocks));
+    memset(j->hits, 0, sizeof(j->hits));
+    memset(j->covered, 0, sizeof(j->covered));
+
+    j->code_ptr = j->code;
+}
+
+/*
+ * Translate the block starting at 'start'. Returns NULL if not even the first
+ * instruction could be translated.
+ *
+ * An IF* is compiled together with the instruction following it, which is
+ * jumped over if the condition fails.  Both paths leave the block afterwards.
+ */
+static jitcode compile(dcpu16 *cpu, uint16_t start) {
+    dcpu16jit *j = cpu->jit;
+    uint8_t *body, *entry;
+    uint32_t pc = start;
+    int count = 0, cost = 0, done = 0, pc_written = 0, v;
+
+    /* Pending skip after an IF* */
+    uint8_t *skip = NULL;
+    int skip_cost = 0;
+
+    if ((j->code + JIT_CODESIZE - j->code_ptr) < JIT_MAXCODE)
+        flush(j);
+
+    for (v = 0; v < NVALUES; ++v)
+        j->slot[v] = -1;
+
+    j->nslots = 0;
+    body = j->code_ptr;
+
+    while (!done && (count <= JIT_MAXINSTR) && ((pc + 3) <= RAMSIZE)) {
+        uint16_t word = cpu->ram[pc];
+        uint8_t op = word & 0x000F;
+        uint8_t fa = (word & 0x03F0) >> 4;
+        uint8_t fb = (word & 0xFC00) >> 10;
+        uint16_t nwa = 0, nwb = 0;
+        uint32_t next = pc + 1;
+
+        /* Only the instruction following an IF* may exceed the limit */
+        if ((count == JIT_MAXINSTR) && (skip == NULL))
+            break;
+
+        if (op == 0x0) {
+            /* Leave unknown nonbasic opcodes to the interpreter */
+            if (fa != 0x01)
+                break;
+
+            fa = fb;
+            fb = 0x20;
+        }
+
+        if (USES_NEXT_WORD(fa))
+            nwa = cpu->ram[next++];
+        if (USES_NEXT_WORD(fb))
+            nwb = cpu->ram[next++];
+
+        /* This is the conditional instruction, the block ends after it */
+        if (skip != NULL)
+            done = 1;
+
+        cost += NEXT_WORD_COST(fa, nwa) + NEXT_WORD_COST(fb, nwb);
+        count++;
+
+        emit_operand_load(j, EAX, fa, nwa, next);
+        emit_operand_load(j, ECX, fb, nwb, next);
+
+        switch (op) {
+        case 0x0: /* JSR */
+            emit_store16(j, EAX, OFF_PC);
+            emit_push_address(j);
+            emit_mov_imm(j, EDX, next);
+            emit_call(j, jit_store);
+
+            cost += 2;
+            done = pc_written = 1;
+            pc = next;
+            continue;
+
+        case 0x1: emit_rr(j, 0x89, EAX, ECX); cost += 1; break; /* mov */
+        case 0x9: emit_rr(j, 0x21, EAX, ECX); cost += 1; break; /* and */
+        case 0xA: emit_rr(j, 0x09, EAX, ECX); cost += 1; break; /* or */
+        case 0xB: emit_rr(j, 0x31, EAX, ECX); cost += 1; break; /* xor */
+
+        case 0x2: /* ADD */
+        case 0x3: /* SUB */
+            /*
+             * The carry (0x0001) or borrow (0xFFFF) ends up in the upper
+             * half of eax
+             */
+            emit_rr(j, op == 0x2 ? 0x01 : 0x29, EAX, ECX);
+            emit_overflow(j);
+            cost += 2;
+            break;
+
+        case 0x4: /* MUL */
+            emit8(j, 0x0F); emit8(j, 0xAF); emit8(j, 0xC1); /* imul eax, ecx */
+            emit_overflow(j);
+            cost += 2;
+            break;
+
+        case 0x5: emit_helper(j, jit_div, 1); cost += 3; break;
+        case 0x6: emit_helper(j, jit_mod, 0); cost += 3; break;
+        case 0x7: emit_helper(j, jit_shl, 1); cost += 2; break;
+        case 0x8: emit_helper(j, jit_shr, 1); cost += 2; break;
+
+        default: /* IFE, IFN, IFG, IFB */
+            if (op == 0xF)
+                emit_rr(j, 0x85, EAX, ECX);           /* test eax, ecx */
+            else
+                emit_rr(j, 0x39, EAX, ECX);           /* cmp eax, ecx */
+
+            emit8(j, 0x0F);
+            switch (op) {
+            case 0xC: emit8(j, 0x95); break;          /* setne */
+            case 0xD: emit8(j, 0x94); break;          /* sete */
+            case 0xE: emit8(j, 0x96); break;          /* setbe */
+            case 0xF: emit8(j, 0x94); break;          /* sete */
+            }
+            emit8(j, 0xC2);
+
+            emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xD2); /* movzx edx, dl */
+            emit8(j, 0x89); emit8(j, 0x93); emit32(j, OFF_SKIP); /* mov */
+            emit8(j, 0x01); emit8(j, 0x93); emit32(j, OFF_IDLE); /* add */
+
+            cost += 2;
+            pc = next;
+
+            /* Unless this is the conditional instruction itself, compile
+             * the next one behind a jump */
+            if (!done) {
+                emit_rr(j, 0x85, EDX, EDX);           /* test edx, edx */
+                emit8(j, 0x0F); emit8(j, 0x85); emit32(j, 0); /* jnz */
+                skip = j->code_ptr;
+                skip_cost = cost;
+            }
+
+            continue;
+        }
+
+        /* Store the result in eax into a */
+        if (fa < 0x08) {
+            emit_put(j, fa, EAX);
+        } else if (fa == 0x1B) {
+            emit_put(j, V_SP, EAX);
+        } else if (fa == 0x1C) {
+            emit_store16(j, EAX, OFF_PC);
+            done = pc_written = 1;
+        } else if (fa == 0x1D) {
+            emit_put(j, V_O, EAX);
+        } else {
+            uint8_t *stay;
+
+            emit_rr(j, 0x89, EDX, EAX);               /* mov edx, eax */
+
+            if (emit_operand_address(j, fa, nwa)) {
+                emit_call(j, jit_store);
+
+                /* Bail out if this block was just overwritten */
+                emit_rr(j, 0x85, EAX, EAX);           /* test eax, eax */
+                emit8(j, 0x0F); emit8(j, 0x84); emit32(j, 0); /* jz */
+                stay = j->code_ptr;
+
+                emit_exit(j, next, cost, count);
+
+                *(int32_t *)(stay - 4) = j->code_ptr - stay;
+            }
+        }
+
+        pc = next;
+    }
+
+    if (count == 0) {
+        j->code_ptr = body;
+        return NULL;
+    }
+
+    if ((skip != NULL) && !done) {
+        /* Nothing was compiled after the IF*, let the interpreter skip */
+        *(int32_t *)(skip - 4) = 0;
+        skip = NULL;
+    }
+
+    emit_exit(j, pc_written ? -1 : (int32_t)pc, cost, count);
+
+    if (skip != NULL) {
+        /* The conditional instruction was skipped */
+        *(int32_t *)(skip - 4) = j->code_ptr - skip;
+
+        emit8(j, 0xC7); emit8(j, 0x83); emit32(j, OFF_SKIP); /* mov */
+        emit32(j, 0);
+        emit_exit(j, pc, skip_cost, count);
+    }
+
+    entry = j->code_ptr;
+    emit_entry(j, body);
+
+    j->blocks[start].code = (jitcode)entry;
+    j->blocks[start].end = pc;
+
+    for (pc = start; pc < j->blocks[start].end; ++pc)
+        j->covered[pc]++;
+
+    if (j->perfmap) {
+        fprintf(j->perfmap, "%lx %lx dcpu16_%04X\n", (unsigned long)body,
+                (unsigned long)(j->code_ptr - body), start);
+        fflush(j->perfmap);
+    }
+
+    return j->blocks[start].code;
+}
+
+int dcpu16_jit_init(dcpu16 *cpu) {
+    dcpu16jit *j = calloc(1, sizeof(dcpu16jit));
+    char path[64];
+
+    if (j == NULL)
+        return -1;
+
+    j->code = mmap(NULL, JIT_CODESIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (j->code == MAP_FAILED) {
+        free(j);
+        return -1;
+    }
+
+    j->at_leader = 1;
+    flush(j);
+
+    /* Appended to, as other CPUs may be writing to it as well */
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    j->perfmap = fopen(path, "a");
+
+    cpu->jit = j;
+    cpu->invalidate = dcpu16_jit_invalidate;
+
+    return 0;
+}
+
+void dcpu16_jit_cleanup(dcpu16 *cpu) {
+    dcpu16jit *j = cpu->jit;
+
+    if (j == NULL)
+        return;
+
+    if (j->perfmap)
+        fclose(j->perfmap);
+
+    munmap(j->code, JIT_CODESIZE);
+    free(j);
+
+    cpu->jit = NULL;
+    cpu->invalidate = NULL;
+}
+
+void dcpu16_jit_invalidate(dcpu16 *cpu, uint16_t addr) {
+    dcpu16jit *j = cpu->jit;
+    uint32_t s;
+    uint32_t first = (addr >= JIT_MAXWORDS) ? addr - JIT_MAXWORDS + 1 : 0;
+
+    if ((j == NULL) || !j->covered[addr])
+        return;
+
+    for (s = first; s <= addr; ++s) {
+        jitblock *b = &j->blocks[s];
+
+        if ((b->code != NULL) && (addr < b->end)) {
+            uint32_t a;
+
+            for (a = s; a < b->end; ++a)
+                j->covered[a]--;
+
+            if (b == j->running)
+                j->running_killed = 1;
+
+            b->code = NULL;
+            j->hits[s] = 0;
+        }
+    }
+}
+
+int dcpu16_jit_step(dcpu16 *cpu) {
+    dcpu16jit *j = cpu->jit;
+    uint16_t pc = cpu->pc;
+    int count;
+
+    if (j == NULL) {
+        dcpu16_step(cpu);
+        return 1;
+    }
+
+    if (!cpu->skip_next) {
+        jitblock *b = &j->blocks[pc];
+
+        if ((b->code == NULL) && j->at_leader
+                && (j->hits[pc] != JIT_FAILED)) {
+            if (++j->hits[pc] >= JIT_THRESHOLD) {
+                if (compile(cpu, pc) == NULL)
+                    j->hits[pc] = JIT_FAILED;
+            }
+        }
+
+        if (b->code != NULL) {
+            j->running = b;
+            j->running_killed = 0;
+
+            count = b->code(cpu);
+
+            j->running = NULL;
+            j->at_leader = 1;
+
+            return count;
+        }
+    }
+
+    dcpu16_step(cpu);
+
+    /* Anything but falling through to the next instruction */
+    j->at_leader = ((uint16_t)(cpu->pc - pc) > 3);
+
+    return 1;
+}
+
+#else /* !x86-64 */
+
+int dcpu16_jit_init(dcpu16 *cpu) {
+    (void)cpu;
+    return -1;
+}
+
+void dcpu16_jit_cleanup(dcpu16 *cpu) {
+    (void)cpu;
+}
+
+int dcpu16_jit_step(dcpu16 *cpu) {
+    dcpu16_step(cpu);
+    return 1;
+}
+
+void dcpu16_jit_invalidate(dcpu16 *cpu, uint16_t addr) {
+    (void)cpu;
+    (void)addr;
+}
+
+#endif
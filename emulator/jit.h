@@ -0,0 +1,18 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "../common/types.h"
+
+/* Longest block, not counting the instruction following a final IF* */
+#define JIT_MAXINSTR    32
+
+/* Most cycles a block may take, 6 per instruction plus 1 for a skip */
+#define JIT_MAXCYCLES   ((JIT_MAXINSTR + 1) * 6 + 1)
+
+int dcpu16_jit_init(dcpu16*);
+void dcpu16_jit_cleanup(dcpu16*);
+
+int dcpu16_jit_step(dcpu16*);
+void dcpu16_jit_invalidate(dcpu16*, uint16_t);
+
+#endif
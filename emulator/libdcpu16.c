@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Public interface of libdcpu16, a thin layer over the core in cpu.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "libdcpu16.h"
+#include "../common/hexdump.h"
+#include "../common/types.h"
+
+
+/*
+ * Returns a new machine in its reset state, or NULL if out of memory
+ */
+dcpu16 *dcpu16_create() {
+    dcpu16 *cpu = malloc(sizeof(dcpu16));
+
+    if ((cpu != NULL) && (dcpu16_init(cpu) < 0)) {
+        free(cpu);
+        return NULL;
+    }
+
+    return cpu;
+}
+
+void dcpu16_destroy(dcpu16 *cpu) {
+    if (cpu == NULL)
+        return;
+
+    dcpu16_free(cpu);
+    free(cpu);
+}
+
+/*
+ * Clears registers, RAM and the cycle counter
+ */
+void dcpu16_reset(dcpu16 *cpu) {
+    struct dcpu16decoded *decoded = cpu->decoded;
+    void (*invalidate)(struct dcpu16*, uint16_t) = cpu->invalidate;
+    struct dcpu16jit *jit = cpu->jit;
+
+    memset(cpu, 0, sizeof(*cpu));
+    memset(decoded, 0, RAMSIZE * sizeof(dcpu16decoded));
+
+    cpu->decoded = decoded;
+    cpu->invalidate = invalidate;
+    cpu->jit = jit;
+
+    memset(cpu->ram_dirty, 0xFF, sizeof(cpu->ram_dirty));
+}
+
+/*
+ * Resets the machine and copies 'words' words from 'image' to the start of
+ * RAM.  Returns -1 if the image does not fit.
+ */
+int dcpu16_load(dcpu16 *cpu, const uint16_t *image, size_t words) {
+    if (words > RAMSIZE)
+        return -1;
+
+    dcpu16_reset(cpu);
+    memcpy(cpu->ram, image, words * sizeof(uint16_t));
+
+    return 0;
+}
+
+/*
+ * Like dcpu16_load(), but for a hexdump as written by dcpu16asm
+ */
+int dcpu16_load_hexdump(dcpu16 *cpu, const char *text, size_t length,
+                        int bigendian) {
+    FILE *f;
+    int ret;
+
+    if ((f = fmemopen((void*)text, length, "r")) == NULL)
+        return -1;
+
+    dcpu16_reset(cpu);
+    ret = read_hexdump(f, bigendian ? BIGENDIAN : LITTLEENDIAN,
+                       cpu->ram, RAMSIZE);
+
+    fclose(f);
+
+    return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Runs the machine for at least 'cycles' clock cycles.  The last instruction
+ * is always completed, cycles spent beyond the limit are taken into account
+ * when running the next time.
+ */
+dcpu16stop dcpu16_run(dcpu16 *cpu, uint64_t cycles, int flags) {
+    uint64_t until = cpu->cycles + cycles;
+
+    while (cpu->cycles < until) {
+        uint16_t pc = cpu->pc;
+
+        dcpu16_step(cpu);
+
+        cpu->cycles += 1 + cpu->idle;
+        cpu->idle = 0;
+
+        if ((flags & DCPU16_STOP_ON_HALT) && (pc == cpu->pc))
+            return DCPU16_HALTED;
+    }
+
+    return DCPU16_DONE;
+}
+
+uint64_t dcpu16_cycles(dcpu16 *cpu) {
+    return cpu->cycles;
+}
+
+uint16_t dcpu16_peek(dcpu16 *cpu, uint16_t addr) {
+    return cpu->ram[addr];
+}
+
+uint16_t dcpu16_get_register(dcpu16 *cpu, dcpu16register r) {
+    switch (r) {
+    case DCPU16_PC: return cpu->pc;
+    case DCPU16_SP: return cpu->sp;
+    case DCPU16_O:  return cpu->o;
+    default:        return cpu->registers[r];
+    }
+}
+
+void dcpu16_set_register(dcpu16 *cpu, dcpu16register r, uint16_t val) {
+    switch (r) {
+    case DCPU16_PC: cpu->pc = val; break;
+    case DCPU16_SP: cpu->sp = val; break;
+    case DCPU16_O:  cpu->o = val; break;
+    default:        cpu->registers[r] = val;
+    }
+}
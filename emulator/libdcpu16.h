@@ -0,0 +1,57 @@
+#ifndef LIBDCPU16_H
+#define LIBDCPU16_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libdcpu16, the emulator core for embedding.  Machines share no state, so
+ * any number of them can be driven from any number of threads, as long as
+ * each machine is only used by one thread at a time.
+ */
+
+#ifndef TYPES_H
+typedef struct dcpu16 dcpu16;
+#endif
+
+/* Why dcpu16_run() returned */
+typedef enum {
+    DCPU16_DONE,    /* All cycles asked for have passed */
+    DCPU16_HALTED   /* The PC did not change after an instruction */
+} dcpu16stop;
+
+typedef enum {
+    DCPU16_A, DCPU16_B, DCPU16_C,
+    DCPU16_X, DCPU16_Y, DCPU16_Z,
+    DCPU16_I, DCPU16_J,
+    DCPU16_PC, DCPU16_SP, DCPU16_O
+} dcpu16register;
+
+/* Flags for dcpu16_run() */
+#define DCPU16_STOP_ON_HALT 1
+
+/* Flags for dcpu16_save() */
+#define DCPU16_DELTA 1
+
+dcpu16 *dcpu16_create();
+void dcpu16_destroy(dcpu16*);
+void dcpu16_reset(dcpu16*);
+
+int dcpu16_load(dcpu16*, const uint16_t*, size_t);
+int dcpu16_load_hexdump(dcpu16*, const char*, size_t, int);
+
+dcpu16stop dcpu16_run(dcpu16*, uint64_t, int);
+uint64_t dcpu16_cycles(dcpu16*);
+
+uint16_t dcpu16_peek(dcpu16*, uint16_t);
+void dcpu16_poke(dcpu16*, uint16_t, uint16_t);
+
+uint16_t dcpu16_get_register(dcpu16*, dcpu16register);
+void dcpu16_set_register(dcpu16*, dcpu16register, uint16_t);
+
+size_t dcpu16_save(dcpu16*, void*, size_t, int);
+int dcpu16_restore(dcpu16*, const void*, size_t);
+int dcpu16_save_file(dcpu16*, const char*, int);
+int dcpu16_restore_file(dcpu16*, const char*);
+
+#endif
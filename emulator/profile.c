@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Execution profiler.  Counts the instructions executed, the instructions
+ * skipped by an IF* and the cycles spent at each address and, given the map
+ * written by "dcpu16asm --map", relates them to source lines and labels.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "profile.h"
+#include "../common/types.h"
+
+#define MAXLINE 1024
+
+typedef struct {
+    char *name;
+    uint16_t pc;
+    int line;   /* Of the definition, 0 if the map does not say */
+    int index;  /* In the map */
+} label;
+
+static uint64_t executed[RAMSIZE];
+static uint64_t skipped[RAMSIZE];
+static uint64_t spent[RAMSIZE];
+
+/* Source line of each instruction, 0 if unknown */
+static int lines[RAMSIZE];
+
+static label *labels = NULL;
+static int nlabels = 0;
+
+static int by_cycles(const void*, const void*);
+static int by_pc(const void*, const void*);
+static const label *label_of(uint16_t);
+
+
+/*
+ * Charges an instruction at 'pc' that took 'cycles' cycles, or was passed
+ * over in them if 'skip' is set
+ */
+void profile_count(uint16_t pc, int cycles, int skip) {
+    if (skip)
+        skipped[pc]++;
+    else
+        executed[pc]++;
+
+    spent[pc] += cycles;
+}
+
+/*
+ * Reads a map written by dcpu16asm.  Returns -1 after printing a message on
+ * errors.
+ */
+int profile_load_map(const char *fname) {
+    FILE *f = fopen(fname, "r");
+    char buffer[MAXLINE];
+    int size = 0;
+
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open '%s' -- aborting\n", fname);
+        return -1;
+    }
+
+    while (fgets(buffer, sizeof(buffer), f) != NULL) {
+        char name[MAXLINE];
+        unsigned int pc;
+        int line, fields;
+
+        if ((buffer[0] == ';') || (buffer[0] == '\n'))
+            continue;
+
+        /* Maps written by dcpu16ld do not give the line of labels */
+        if ((fields = sscanf(buffer, ":%s %x %d", name, &pc, &line)) >= 2) {
+            if (nlabels == size) {
+                size = size ? size * 2 : 64;
+                labels = realloc(labels, size * sizeof(label));
+            }
+
+            if ((labels == NULL)
+                    || ((labels[nlabels].name = strdup(name)) == NULL)) {
+                fprintf(stderr, "Out of memory -- aborting\n");
+                fclose(f);
+                return -1;
+            }
+
+            labels[nlabels].pc = pc;
+            labels[nlabels].line = (fields == 3) ? line : 0;
+            labels[nlabels].index = nlabels;
+            nlabels++;
+        } else if ((sscanf(buffer, "%x %d", &pc, &line) == 2)
+                   && (pc < RAMSIZE)) {
+            lines[pc] = line;
+        } else {
+            fprintf(stderr, "%s: Invalid map -- aborting\n", fname);
+            fclose(f);
+            return -1;
+        }
+    }
+
+    fclose(f);
+
+    qsort(labels, nlabels, sizeof(label), by_pc);
+
+    return 0;
+}
+
+/*
+ * Lists all addresses executed, the most expensive ones first, followed by
+ * the totals per label if a map was loaded
+ */
+void profile_report(FILE *f) {
+    static uint16_t order[RAMSIZE];
+    uint64_t total_spent = 0;
+    int i, n = 0;
+
+    for (i = 0; i < RAMSIZE; ++i) {
+        if (executed[i] || skipped[i]) {
+            order[n++] = i;
+            total_spent += spent[i];
+        }
+    }
+
+    if (!total_spent)
+        total_spent = 1;
+
+    qsort(order, n, sizeof(uint16_t), by_cycles);
+
+    fprintf(f, "%-4s  %12s  %6s  %12s  %12s  %6s  %s\n", "ADDR", "CYCLES",
+            "%", "INSTRUCTIONS", "SKIPPED", "LINE", "LABEL");
+
+    for (i = 0; i < n; ++i) {
+        uint16_t pc = order[i];
+        const label *l = label_of(pc);
+
+        fprintf(f, "%04X  %12llu  %6.2f  %12llu  %12llu  ", pc,
+                (unsigned long long)spent[pc], 100.0 * spent[pc] / total_spent,
+                (unsigned long long)executed[pc],
+                (unsigned long long)skipped[pc]);
+
+        if (lines[pc])
+            fprintf(f, "%6d  ", lines[pc]);
+        else
+            fprintf(f, "%6s  ", "-");
+
+        if (l == NULL)
+            fprintf(f, "-\n");
+        else if (l->pc == pc)
+            fprintf(f, "%s\n", l->name);
+        else
+            fprintf(f, "%s+%d\n", l->name, pc - l->pc);
+    }
+
+    if (!nlabels)
+        return;
+
+    fprintf(f, "\n%-24s  %12s  %6s  %12s  %12s\n", "LABEL", "CYCLES", "%",
+            "INSTRUCTIONS", "SKIPPED");
+
+    for (i = 0; i < nlabels; ++i) {
+        uint32_t end = (i + 1 < nlabels) ? labels[i + 1].pc : RAMSIZE;
+        uint64_t e = 0, k = 0, s = 0;
+        uint32_t pc;
+
+        for (pc = labels[i].pc; pc < end; ++pc) {
+            e += executed[pc];
+            k += skipped[pc];
+            s += spent[pc];
+        }
+
+        if (e || k)
+            fprintf(f, "%-24s  %12llu  %6.2f  %12llu  %12llu\n",
+                    labels[i].name, (unsigned long long)s,
+                    100.0 * s / total_spent, (unsigned long long)e,
+                    (unsigned long long)k);
+    }
+}
+
+/*
+ * The closest label at or before 'pc'
+ */
+static const label *label_of(uint16_t pc) {
+    int lo = 0, hi = nlabels;
+
+    /* First label after pc */
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (labels[mid].pc <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo ? &labels[lo - 1] : NULL;
+}
+
+static int by_cycles(const void *a, const void *b) {
+    uint64_t x = spent[*(const uint16_t*)a], y = spent[*(const uint16_t*)b];
+
+    return (x < y) - (x > y);
+}
+
+static int by_pc(const void *a, const void *b) {
+    const label *x = a, *y = b;
+
+    if (x->pc != y->pc)
+        return x->pc - y->pc;
+
+    return (x->line != y->line) ? (x->line - y->line) : (x->index - y->index);
+}
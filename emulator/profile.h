@@ -0,0 +1,12 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+void profile_count(uint16_t, int, int);
+int profile_load_map(const char*);
+void profile_report(FILE*);
+
+#endif
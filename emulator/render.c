@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Render thread.  Owns the terminal while the CPU runs on the main thread, so
+ * a slow terminal never stalls the emulated clock.
+ *
+ * The CPU thread publishes what the GUI shows into a snapshot guarded by a
+ * sequence lock: the sequence number is odd while the snapshot is being
+ * written, and readers copy it out and retry if the number was odd or
+ * changed meanwhile.  Neither side ever waits for the other.
+ *
+ * Key presses travel the other way through a single producer, single
+ * consumer ring buffer.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <ncurses.h>
+
+#include "gui.h"
+#include "render.h"
+#include "../common/types.h"
+
+/* Must be a power of two */
+#define KEYQUEUE 64
+
+static pthread_t thread;
+static int fps;
+static int stopping = 0;
+
+static unsigned int seq = 0;
+static dcpu16screen published;
+
+static int keys[KEYQUEUE];
+static unsigned int key_head = 0;  /* Only written by the render thread */
+static unsigned int key_tail = 0;  /* Only written by the CPU thread */
+
+static void *render_main(void*);
+static void read_snapshot(dcpu16screen*);
+static void push_key(int);
+
+
+/*
+ * Starts the render thread, drawing 'rate' frames per second.  initgui() must
+ * have been called before.
+ */
+int render_start(dcpu16 *cpu, int rate) {
+    memcpy(published.vram, cpu->ram + VRAM, sizeof(published.vram));
+    memset(cpu->vram_dirty, 0, sizeof(cpu->vram_dirty));
+
+    fps = rate;
+
+    return pthread_create(&thread, NULL, render_main, NULL) ? -1 : 0;
+}
+
+/*
+ * Draws a last frame and waits for the render thread to exit
+ */
+void render_stop() {
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+
+    pthread_join(thread, NULL);
+}
+
+/*
+ * Called by the CPU thread to hand the current state to the GUI.  Only the
+ * screen cells written to since the last call are copied.
+ */
+void render_publish(dcpu16 *cpu, double speed, int turbo) {
+    unsigned int s = seq;
+    uint16_t x, y;
+
+    __atomic_store_n(&seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(published.registers, cpu->registers, sizeof(cpu->registers));
+    published.pc = cpu->pc;
+    published.sp = cpu->sp;
+    published.o = cpu->o;
+    published.speed = speed;
+    published.turbo = turbo;
+
+    for (y = 0; y < VRAMHEIGHT; ++y) {
+        uint32_t dirty = cpu->vram_dirty[y];
+        uint16_t row = y * VRAMWIDTH;
+
+        cpu->vram_dirty[y] = 0;
+
+        for (x = 0; dirty; ++x, dirty >>= 1)
+            if (dirty & 1)
+                published.vram[row + x] = cpu->ram[VRAM + row + x];
+    }
+
+    __atomic_store_n(&seq, s + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Called by the CPU thread, returns the oldest key pressed not yet returned,
+ * or -1
+ */
+int render_getkey() {
+    unsigned int tail = key_tail;
+    int c;
+
+    if (tail == __atomic_load_n(&key_head, __ATOMIC_ACQUIRE))
+        return -1;
+
+    c = keys[tail % KEYQUEUE];
+    __atomic_store_n(&key_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return c;
+}
+
+static void read_snapshot(dcpu16screen *frame) {
+    unsigned int before, after;
+
+    do {
+        before = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        memcpy(frame, &published, sizeof(*frame));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || (before != after));
+}
+
+/*
+ * Keys pressed while the queue is full are dropped
+ */
+static void push_key(int c) {
+    unsigned int head = key_head;
+
+    if (head - __atomic_load_n(&key_tail, __ATOMIC_ACQUIRE) >= KEYQUEUE)
+        return;
+
+    keys[head % KEYQUEUE] = c;
+    __atomic_store_n(&key_head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void *render_main(void *arg) {
+    dcpu16screen frame;
+    struct timespec next_frame, now;
+    long frame_ns = 1000000000L / fps;
+
+    (void)arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &next_frame);
+
+    for (;;) {
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        long wait;
+        int c;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wait = (next_frame.tv_sec - now.tv_sec) * 1000000000L
+             + (next_frame.tv_nsec - now.tv_nsec);
+
+        if (stop || (wait <= 0)) {
+            read_snapshot(&frame);
+            updategui(&frame);
+
+            if (stop)
+                break;
+
+            next_frame = now;
+            next_frame.tv_nsec += frame_ns;
+
+            if (next_frame.tv_nsec >= 1000000000L) {
+                next_frame.tv_nsec -= 1000000000L;
+                next_frame.tv_sec++;
+            }
+
+            wait = frame_ns;
+        }
+
+        /* Wait for input until the next frame is due */
+        timeout((wait + 999999) / 1000000);
+
+        if ((c = getch()) != ERR)
+            push_key(c);
+    }
+
+    return NULL;
+}
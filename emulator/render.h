@@ -0,0 +1,13 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "../common/types.h"
+
+
+int render_start(dcpu16*, int);
+void render_stop();
+
+void render_publish(dcpu16*, double, int);
+int render_getkey();
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Snapshots of the complete machine state.
+ *
+ * A snapshot is a header holding the registers and a bitmap of the RAM pages
+ * it contains, followed by those pages in order.  Full snapshots contain all
+ * pages, delta snapshots only the ones written to since the last snapshot was
+ * saved or restored.  To get back to a delta snapshot, restore the full one
+ * it is based on and every delta after it in order.  Every snapshot carries
+ * a checksum of the machine state it holds, and deltas the checksum of the
+ * one they are based on, so a delta restored onto any other state is
+ * rejected.
+ *
+ * Words are stored in host byte order, so restoring is little more than a
+ * memcpy() per page.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "libdcpu16.h"
+#include "../common/types.h"
+
+#define MAGIC     "D16S"
+#define BYTEORDER 0x0102
+
+typedef struct {
+    uint64_t cycles;
+    uint64_t checksum;  /* Of the state held */
+    uint64_t base;      /* Checksum of the snapshot a delta is based on */
+    uint32_t pages[PAGES / 32];  /* Pages following the header */
+    char magic[4];
+    uint16_t byteorder;
+    uint16_t flags;
+    uint16_t registers[8];
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t o;
+    uint16_t skip_next;
+    uint16_t idle;
+} snapshotheader;
+
+#define HAS_PAGE(bits, p) ((bits)[(p) / 32] & (1u << ((p) % 32)))
+
+
+/*
+ * FNV-1a hash of the registers and RAM, never 0
+ */
+static uint64_t checksum(const dcpu16 *cpu) {
+    const uint8_t *p;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint16_t regs[11];
+    size_t i;
+
+    memcpy(regs, cpu->registers, sizeof(cpu->registers));
+    regs[8] = cpu->pc;
+    regs[9] = cpu->sp;
+    regs[10] = cpu->o;
+
+    for (p = (const uint8_t*)regs, i = 0; i < sizeof(regs); ++i)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+
+    for (p = (const uint8_t*)cpu->ram, i = 0; i < sizeof(cpu->ram); ++i)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+
+    return h ? h : 1;
+}
+
+static size_t snapshot_size(const uint32_t *pages) {
+    size_t size = sizeof(snapshotheader);
+    int i;
+
+    for (i = 0; i < PAGES / 32; ++i)
+        size += __builtin_popcount(pages[i]) * PAGESIZE * sizeof(uint16_t);
+
+    return size;
+}
+
+/*
+ * Writes a snapshot (only the pages changed since the last one if 'flags'
+ * has DCPU16_DELTA) to 'buf' and returns its size.  If that is more than
+ * 'size', nothing is written, so dcpu16_save(cpu, NULL, 0, flags) tells how
+ * much space is needed.  Without an earlier snapshot to base a delta on, a
+ * full one is written.
+ */
+size_t dcpu16_save(dcpu16 *cpu, void *buf, size_t size, int flags) {
+    snapshotheader h;
+    uint8_t *p = buf;
+    size_t needed;
+    int i;
+
+    memset(&h, 0, sizeof(h));
+
+    if (!cpu->snapshot)
+        flags &= ~DCPU16_DELTA;
+
+    if (flags & DCPU16_DELTA)
+        memcpy(h.pages, cpu->ram_dirty, sizeof(h.pages));
+    else
+        memset(h.pages, 0xFF, sizeof(h.pages));
+
+    if ((needed = snapshot_size(h.pages)) > size)
+        return needed;
+
+    memcpy(h.magic, MAGIC, sizeof(h.magic));
+    h.byteorder = BYTEORDER;
+    h.flags = flags & DCPU16_DELTA;
+    memcpy(h.registers, cpu->registers, sizeof(h.registers));
+    h.pc = cpu->pc;
+    h.sp = cpu->sp;
+    h.o = cpu->o;
+    h.skip_next = cpu->skip_next;
+    h.idle = cpu->idle;
+    h.cycles = cpu->cycles;
+    h.checksum = checksum(cpu);
+    h.base = (flags & DCPU16_DELTA) ? cpu->snapshot : 0;
+
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+
+    for (i = 0; i < PAGES; ++i) {
+        if (HAS_PAGE(h.pages, i)) {
+            memcpy(p, cpu->ram + i * PAGESIZE, PAGESIZE * sizeof(uint16_t));
+            p += PAGESIZE * sizeof(uint16_t);
+        }
+    }
+
+    memset(cpu->ram_dirty, 0, sizeof(cpu->ram_dirty));
+    cpu->snapshot = h.checksum;
+
+    return needed;
+}
+
+/*
+ * Restores a snapshot written by dcpu16_save().  Returns -1 if 'buf' does
+ * not hold a valid snapshot, or a delta not based on the last snapshot
+ * saved or restored.
+ */
+int dcpu16_restore(dcpu16 *cpu, const void *buf, size_t size) {
+    const uint8_t *p = buf;
+    snapshotheader h;
+    int i;
+
+    if (size < sizeof(h))
+        return -1;
+
+    memcpy(&h, p, sizeof(h));
+    p += sizeof(h);
+
+    if (memcmp(h.magic, MAGIC, sizeof(h.magic))
+            || (h.byteorder != BYTEORDER)
+            || (snapshot_size(h.pages) != size))
+        return -1;
+
+    if ((h.flags & DCPU16_DELTA) && (h.base != cpu->snapshot))
+        return -1;
+
+    memcpy(cpu->registers, h.registers, sizeof(cpu->registers));
+    cpu->pc = h.pc;
+    cpu->sp = h.sp;
+    cpu->o = h.o;
+    cpu->skip_next = h.skip_next;
+    cpu->idle = h.idle;
+    cpu->cycles = h.cycles;
+
+    for (i = 0; i < PAGES; ++i) {
+        if (HAS_PAGE(h.pages, i)) {
+            memcpy(cpu->ram + i * PAGESIZE, p, PAGESIZE * sizeof(uint16_t));
+            dcpu16_invalidate(cpu, i * PAGESIZE, PAGESIZE);
+            p += PAGESIZE * sizeof(uint16_t);
+        }
+    }
+
+    memset(cpu->ram_dirty, 0, sizeof(cpu->ram_dirty));
+    cpu->snapshot = h.checksum;
+
+    return 0;
+}
+
+int dcpu16_save_file(dcpu16 *cpu, const char *fname, int flags) {
+    size_t size = dcpu16_save(cpu, NULL, 0, flags);
+    void *buf = malloc(size);
+    FILE *f;
+    int ret = -1;
+
+    if (buf == NULL)
+        return -1;
+
+    dcpu16_save(cpu, buf, size, flags);
+
+    if ((f = fopen(fname, "wb")) != NULL) {
+        if (fwrite(buf, 1, size, f) == size)
+            ret = 0;
+
+        if (fclose(f) != 0)
+            ret = -1;
+    }
+
+    free(buf);
+
+    return ret;
+}
+
+int dcpu16_restore_file(dcpu16 *cpu, const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    void *buf = NULL;
+    long size;
+    int ret = -1;
+
+    if (f == NULL)
+        return -1;
+
+    if ((fseek(f, 0, SEEK_END) == 0) && ((size = ftell(f)) > 0)
+            && (fseek(f, 0, SEEK_SET) == 0)
+            && ((buf = malloc(size)) != NULL)
+            && (fread(buf, 1, size, f) == (size_t)size))
+        ret = dcpu16_restore(cpu, buf, size);
+
+    free(buf);
+    fclose(f);
+
+    return ret;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Threaded execution engine, built instead of the token based one in
+ * emulator.c if DCPU16_THREADED is defined (make THREADED=1).
+ *
+ * Rather than translating instructions into dcpu16instructions and switching
+ * on parser tokens, this dispatches directly on the 4 bit opcode and the two
+ * 6 bit operand fields of the instruction word through tables of label
+ * addresses (GCC's "labels as values").  Operands are resolved by small
+ * threaded subroutines that jump back through 'ret' when done.
+ *
+ * Guest visible behaviour is identical to the token based engine, including
+ * operand side effects being applied once for loading and once more for
+ * storing the result (i.e. "SET PUSH, A" moves SP twice).  Since the two
+ * behave the same, steps being traced are left to the token based engine,
+ * which keeps the dispatch here free of tracing.
+ */
+#ifdef DCPU16_THREADED
+
+#ifndef __GNUC__
+#error "The threaded engine requires GCC's computed gotos"
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "../common/types.h"
+
+
+/* Operand fields using a next word: [register + next word], [next word]
+ * and next word literals */
+#define USES_NEXT_WORD(o) ((((o) >= 0x10) && ((o) < 0x18)) \
+                           || ((o) == 0x1e) || ((o) == 0x1f))
+
+/* Like the token based engine, only charge for literals that do not fit
+ * into the operand field */
+#define NEXT_WORD_COST(o, nw) (((o) == 0x1f) ? ((nw) > 0x1f) \
+                                              : USES_NEXT_WORD(o))
+
+void dcpu16_step(dcpu16 *cpu) {
+    static void *const opcodes[16] = {
+        &&op_nonbasic, &&op_set, &&op_add, &&op_sub,
+        &&op_mul,      &&op_div, &&op_mod, &&op_shl,
+        &&op_shr,      &&op_and, &&op_bor, &&op_xor,
+        &&op_ife,      &&op_ifn, &&op_ifg, &&op_ifb
+    };
+
+    static void *const operands[64] = {
+        &&reg,     &&reg,     &&reg,     &&reg,
+        &&reg,     &&reg,     &&reg,     &&reg,
+        &&ref,     &&ref,     &&ref,     &&ref,
+        &&ref,     &&ref,     &&ref,     &&ref,
+        &&ref_off, &&ref_off, &&ref_off, &&ref_off,
+        &&ref_off, &&ref_off, &&ref_off, &&ref_off,
+        &&pop,     &&peek,    &&push,    &&sp,
+        &&pc,      &&o,       &&ref_nw,  &&lit_nw,
+        &&lit, &&lit, &&lit, &&lit, &&lit, &&lit, &&lit, &&lit,
+        &&lit, &&lit, &&lit, &&lit, &&lit, &&lit, &&lit, &&lit,
+        &&lit, &&lit, &&lit, &&lit, &&lit, &&lit, &&lit, &&lit,
+        &&lit, &&lit, &&lit, &&lit, &&lit, &&lit, &&lit, &&lit
+    };
+
+    uint16_t word;
+    uint8_t op, fa, fb;
+    uint16_t nwa = 0, nwb = 0;
+
+    /* State of the operand subroutines */
+    uint8_t field = 0;
+    uint16_t nw = 0;
+    uint16_t *ptr = NULL;  /* Resolved operand, NULL for literals */
+    int32_t addr = -1;     /* RAM address of the operand, if any */
+    uint16_t literal = 0;
+    void *ret = NULL;
+
+    uint16_t a = 0, b = 0, result = 0;
+    int cost = 0;
+
+    if (cpu->trace != NULL) {
+        dcpu16_traced_step(cpu);
+        return;
+    }
+
+    word = cpu->ram[cpu->pc++];
+    op = word & 0x000F;
+    fa = (word & 0x03F0) >> 4;
+    fb = (word & 0xFC00) >> 10;
+
+    if (op == 0x0) {
+        /* Nonbasic instruction => opcode = a, a = b, b = nothing */
+        if (fa != 0x01) {
+            /* Unknown, skipped silently */
+            if (cpu->skip_next)
+                cpu->skip_next = cpu->idle = 0;
+
+            return;
+        }
+
+        fa = fb;
+        fb = 0x20;
+    }
+
+    if (USES_NEXT_WORD(fa))
+        nwa = cpu->ram[cpu->pc++];
+    if (USES_NEXT_WORD(fb))
+        nwb = cpu->ram[cpu->pc++];
+
+    cost = NEXT_WORD_COST(fa, nwa) + NEXT_WORD_COST(fb, nwb);
+
+    if (cpu->skip_next) {
+        cpu->skip_next = cpu->idle = 0;
+        return;
+    }
+
+    /* Load a */
+    field = fa; nw = nwa; ret = &&loaded_a;
+    goto *operands[field];
+loaded_a:
+    a = ptr ? *ptr : literal;
+
+    /* Load b */
+    field = fb; nw = nwb; ret = &&loaded_b;
+    goto *operands[field];
+loaded_b:
+    b = ptr ? *ptr : literal;
+
+    goto *opcodes[op];
+
+/*
+ * Operand subroutines.  Each one resolves 'field' into either 'ptr' (and
+ * 'addr' for RAM) or 'literal', then returns to 'ret'.
+ */
+#define RESOLVE_RAM(x) do { addr = (uint16_t)(x);              \
+                            ptr = &(cpu->ram[addr]);           \
+                            goto *ret; } while (0)
+
+#define RESOLVE_PTR(x) do { addr = -1; ptr = (x); goto *ret; } while (0)
+
+reg:     RESOLVE_PTR(&(cpu->registers[field]));
+ref:     RESOLVE_RAM(cpu->registers[field - 0x08]);
+ref_off: RESOLVE_RAM(cpu->registers[field - 0x10] + nw);
+pop:     RESOLVE_RAM(cpu->sp++);
+peek:    RESOLVE_RAM(cpu->sp);
+push:    RESOLVE_RAM(--cpu->sp);
+sp:      RESOLVE_PTR(&(cpu->sp));
+pc:      RESOLVE_PTR(&(cpu->pc));
+o:       RESOLVE_PTR(&(cpu->o));
+ref_nw:  RESOLVE_RAM(nw);
+lit_nw:  literal = nw;           RESOLVE_PTR(NULL);
+lit:     literal = field - 0x20; RESOLVE_PTR(NULL);
+
+#undef RESOLVE_RAM
+#undef RESOLVE_PTR
+
+/*
+ * Opcodes.  Those producing a value jump to 'store' afterwards, the others
+ * to 'done'.
+ */
+op_nonbasic:
+    /* JSR is the only nonbasic opcode */
+    cpu->sp--;
+    dcpu16_poke(cpu, cpu->sp, cpu->pc);
+    cpu->pc = a;
+    cost += 2;
+    goto done;
+
+op_set: result = b;     cost += 1; goto store;
+op_and: result = a & b; cost += 1; goto store;
+op_bor: result = a | b; cost += 1; goto store;
+op_xor: result = a ^ b; cost += 1; goto store;
+
+op_add:
+    result = a + b;
+    cpu->o = ((result < a) || (result < b));
+    cost += 2;
+    goto store;
+
+op_sub:
+    result = a - b;
+    cpu->o = (result > a) ? 0xFFFF : 0;
+    cost += 2;
+    goto store;
+
+op_mul:
+    result = (uint32_t)a * b;
+    cpu->o = ((uint32_t)a * b) >> 16;
+    cost += 2;
+    goto store;
+
+op_div:
+    if (b != 0) {
+        result = a / b;
+        cpu->o = ((a << 16) / b) & 0xFFFF;
+    } else {
+        result = 0;
+        cpu->o = 0;
+    }
+
+    cost += 3;
+    goto store;
+
+op_mod:
+    result = (b != 0) ? (a % b) : 0;
+    cost += 3;
+    goto store;
+
+op_shl:
+    result = a << b;
+    cpu->o = ((a << b) >> 16) & 0xFFFF;
+    cost += 2;
+    goto store;
+
+op_shr:
+    result = a >> b;
+    cpu->o = ((a << 16) >> b) & 0xFFFF;
+    cost += 2;
+    goto store;
+
+op_ife: cpu->skip_next = !(a == b);      goto skip;
+op_ifn: cpu->skip_next =  (a == b);      goto skip;
+op_ifg: cpu->skip_next = !(a > b);       goto skip;
+op_ifb: cpu->skip_next =  (a & b) == 0;  goto skip;
+
+skip:
+    cost += 2 + cpu->skip_next;
+    goto done;
+
+store:
+    /* Resolve a once more, with all of its side effects */
+    field = fa; nw = nwa; ret = &&resolved_store;
+    goto *operands[field];
+resolved_store:
+    if (addr >= 0)
+        dcpu16_poke(cpu, addr, result);
+    else if (ptr != NULL)
+        *ptr = result;
+
+done:
+    cpu->idle = cost;
+}
+
+#endif /* DCPU16_THREADED */
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Writing execution traces to files.
+ *
+ * The CPU fills a ring buffer of records.  When streaming, the whole ring is
+ * written out every time it fills up, otherwise only the last records are
+ * kept and written when the trace is closed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "trace.h"
+
+typedef struct {
+    dcpu16trace trace;  /* Must be first */
+    FILE *f;
+    int error;
+} tracefile;
+
+
+static void write_records(tracefile *t, uint32_t from, uint32_t count) {
+    if (fwrite(t->trace.records + from, sizeof(dcpu16tracerecord),
+               count, t->f) != count)
+        t->error = 1;
+}
+
+static void flush(dcpu16trace *trace) {
+    write_records((tracefile*)trace, 0, trace->mask + 1);
+}
+
+/*
+ * Opens trace file 'fname' and returns a trace to hand to the CPU, or NULL.
+ * The ring holds at least 'records' entries, rounded up to a power of two.
+ */
+dcpu16trace *trace_open(const char *fname, uint32_t records, int stream) {
+    tracefile *t;
+    dcpu16traceheader h;
+    uint32_t n = 1;
+
+    while ((n < records) && (n < 0x80000000u))
+        n <<= 1;
+
+    if ((t = calloc(1, sizeof(tracefile))) == NULL)
+        return NULL;
+
+    if ((t->trace.records = malloc(n * sizeof(dcpu16tracerecord))) == NULL) {
+        free(t);
+        return NULL;
+    }
+
+    if ((t->f = fopen(fname, "wb")) == NULL) {
+        free(t->trace.records);
+        free(t);
+        return NULL;
+    }
+
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    h.byteorder = TRACE_BYTEORDER;
+    h.size = sizeof(dcpu16tracerecord);
+
+    if (fwrite(&h, sizeof(h), 1, t->f) != 1)
+        t->error = 1;
+
+    t->trace.mask = n - 1;
+    t->trace.flush = stream ? flush : NULL;
+
+    return &(t->trace);
+}
+
+/*
+ * Writes what is left in the ring and closes the trace.  Returns -1 if
+ * anything could not be written.
+ */
+int trace_close(dcpu16trace *trace) {
+    tracefile *t = (tracefile*)trace;
+    uint32_t head = trace->head & trace->mask;
+    int error;
+
+    if (trace->flush != NULL || trace->head <= trace->mask) {
+        write_records(t, 0, head);
+    } else {
+        /* Oldest records first */
+        write_records(t, head, trace->mask + 1 - head);
+        write_records(t, 0, head);
+    }
+
+    error = (fclose(t->f) != 0) || t->error;
+
+    free(trace->records);
+    free(t);
+
+    return error ? -1 : 0;
+}
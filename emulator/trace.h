@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define TRACE_MAGIC     "D16T"
+#define TRACE_BYTEORDER 0x0102
+
+/*
+ * Start of a trace file, followed by dcpu16tracerecords in the order they
+ * were executed
+ */
+typedef struct {
+    char magic[4];
+    uint16_t byteorder;
+    uint16_t size;  /* sizeof(dcpu16tracerecord) */
+} dcpu16traceheader;
+
+dcpu16trace *trace_open(const char*, uint32_t, int);
+int trace_close(dcpu16trace*);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Prints traces written by "dcpu16emu --trace"
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "cpu.h"
+#include "trace.h"
+#include "../common/disassemble.h"
+
+
+void display_help();
+
+int main(int argc, char **argv) {
+    int lopts_index = 0;
+    FILE *f = stdin;
+    dcpu16traceheader h;
+    dcpu16tracerecord r;
+    char buf[64];
+
+    static struct option lopts[] = {
+        {"help",         no_argument, NULL, 'h'},
+        {NULL,           0,           NULL,  0 }
+    };
+
+    for (;;) {
+        int opt = getopt_long(argc, argv, "h", lopts, &lopts_index);
+
+        if (opt < 0)
+            break;
+
+        switch (opt) {
+        case 'h':
+            display_help();
+            return 0;
+
+        case '?':
+            break;
+        }
+    }
+
+    if ((optind < argc) && strcmp(argv[optind], "-")) {
+        if ((f = fopen(argv[optind], "rb")) == NULL) {
+            fprintf(stderr, "Unable to open '%s' -- aborting\n",
+                    argv[optind]);
+            return 1;
+        }
+    }
+
+    if ((fread(&h, sizeof(h), 1, f) != 1)
+            || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic))) {
+        fprintf(stderr, "Not a trace -- aborting\n");
+        return 1;
+    }
+
+    if ((h.byteorder != TRACE_BYTEORDER) || (h.size != sizeof(r))) {
+        fprintf(stderr, "Trace was written on a different machine "
+                        "-- aborting\n");
+        return 1;
+    }
+
+    printf("%-12s %-4s  %-24s %-4s %-4s %s\n",
+           "CYCLE", "PC", "INSTRUCTION", "A", "B", "RESULT");
+
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        disassemble(r.words, buf, sizeof(buf));
+
+        printf("%-12llu %04X  %-24s ", (unsigned long long)r.cycle, r.pc, buf);
+
+        if (r.flags & TRACE_SKIPPED)
+            printf("skipped\n");
+        else if (r.flags & TRACE_WRITES)
+            printf("%04X %04X %04X\n", r.a, r.b, r.result);
+        else
+            printf("%04X %04X\n", r.a, r.b);
+    }
+
+    if (f != stdin)
+        fclose(f);
+
+    return 0;
+}
+
+void display_help() {
+    printf("Usage: dcpu16trace [OPTIONS] [FILENAME]\n"
+           "where OPTIONS is any of:\n"
+           "  -h, --help          Display this help\n"
+           "\n"
+           "FILENAME is a trace written by \"dcpu16emu --trace\", one "
+           "instruction is\n"
+           "printed per line.  Defaults to standard input if no file "
+           "is given.\n");
+}
@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2012
+ *
+ * This file is part of dcpu16tools
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * dcpu16ld links objects written by "dcpu16asm -c" into an image.  The
+ * relocatable sections of the objects are placed one after the other, in
+ * the order given, from the start address on; absolute sections (assembled
+ * after an .org) stay where they are.  Labels an object uses without
+ * defining them are resolved against the labels the other objects define.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "../common/hexdump.h"
+#include "../common/image.h"
+#include "../common/object.h"
+#include "../common/types.h"
+
+/*
+ * An object and where its relocatable section ended up
+ */
+typedef struct {
+    const char *filename;
+    dcpu16object *object;
+    uint32_t base;
+    uint32_t length;  /* Of the relocatable section, 0 if none */
+} module;
+
+/*
+ * A label defined by one of the modules, at its final address
+ */
+typedef struct {
+    const char *name;
+    uint16_t value;
+    int module;
+} symbol;
+
+void display_help();
+int place(module*, int);
+int resolve(module*, int);
+int write_extents(FILE*);
+void write_map(FILE*);
+
+/*
+ * Options and output parameters
+ */
+int flag_be = 0;
+int flag_binary = 0;
+int flag_raw = 0;
+uint16_t ram[RAMSIZE];
+
+/* Module + 1 each word was placed by, 0 if none */
+static int owner[RAMSIZE];
+
+/* Every label defined, sorted by name */
+static symbol *symbols = NULL;
+static int nsymbols = 0;
+
+int main(int argc, char **argv) {
+    int lopts_index = 0;
+    char outfile[256] = "out.hex";
+    const char *mapfile = NULL;
+    uint32_t start = 0;
+    unsigned long addr;
+    char *end;
+    module *modules;
+    int nmodules, i, ret = 0;
+
+    FILE *output = NULL;
+
+    static struct option lopts[] = {
+        {"bigendian", no_argument, NULL, 'b'},
+        {"binary",    no_argument, NULL, 'B'},
+        {"raw",       no_argument, NULL, 'r'},
+        {"help",      no_argument, NULL, 'h'},
+        {"start",     required_argument, NULL, 's'},
+        {"map",       required_argument, NULL, 'm'},
+        {NULL,        0,           NULL,  0 }
+    };
+
+    for (;;) {
+        int opt = getopt_long(argc, argv, "bBrho:s:m:", lopts, &lopts_index);
+
+        if (opt < 0)
+            break;
+
+        switch (opt) {
+        case 0:
+            break;
+
+        case 'b':
+            flag_be = 1;
+            break;
+
+        case 'B':
+            flag_binary = 1;
+            break;
+
+        case 'r':
+            flag_binary = flag_raw = 1;
+            break;
+
+        case 'h':
+            display_help();
+            return 0;
+
+        case 'o':
+            strncpy(outfile, optarg, sizeof(outfile) - 1);
+            break;
+
+        case 's':
+            if (!isdigit((unsigned char)*optarg)
+                    || ((addr = strtoul(optarg, &end, 0)) >= RAMSIZE)
+                    || *end) {
+                fprintf(stderr, "Invalid start address '%s' -- aborting\n",
+                        optarg);
+                return 1;
+            }
+
+            start = addr;
+            break;
+
+        case 'm':
+            mapfile = optarg;
+            break;
+
+        case '?':
+            return 1;
+        }
+    }
+
+    if ((nmodules = argc - optind) < 1) {
+        fprintf(stderr, "No objects given -- aborting\n");
+        return 1;
+    }
+
+    if ((modules = calloc(nmodules, sizeof(module))) == NULL) {
+        fprintf(stderr, "Out of memory -- aborting\n");
+        return 1;
+    }
+
+    for (i = 0; i < nmodules; ++i) {
+        module *m = &(modules[i]);
+        FILE *f;
+
+        m->filename = argv[optind + i];
+
+        if ((f = fopen(m->filename, "r")) == NULL) {
+            fprintf(stderr, "Unable to open '%s' -- aborting\n", m->filename);
+            return 1;
+        }
+
+        m->object = read_object(f);
+        fclose(f);
+
+        if (m->object == NULL) {
+            fprintf(stderr, "'%s' is not a valid object -- aborting\n",
+                    m->filename);
+            return 1;
+        }
+    }
+
+    /* Lay the relocatable sections out, then fill in the addresses */
+    for (i = 0; i < nmodules; ++i) {
+        int j;
+
+        modules[i].base = start;
+
+        for (j = 0; j < modules[i].object->nsections; ++j)
+            if (modules[i].object->sections[j].relocatable)
+                modules[i].length = modules[i].object->sections[j].length;
+
+        if ((start += modules[i].length) > RAMSIZE) {
+            fprintf(stderr, "Relocatable sections up to '%s' exceed 0x%X "
+                            "words -- aborting\n", modules[i].filename,
+                            RAMSIZE);
+            return 1;
+        }
+    }
+
+    if ((place(modules, nmodules) < 0) || (resolve(modules, nmodules) < 0))
+        return 1;
+
+    if ((output = fopen(outfile, flag_binary ? "wb+" : "w+")) == NULL) {
+        fprintf(stderr, "Unable to open '%s' -- aborting\n", outfile);
+        return 1;
+    }
+
+    if (flag_binary)
+        ret = write_image(output, flag_be ? BIGENDIAN : LITTLEENDIAN, ram,
+                          RAMSIZE, flag_raw ? 0 : IMAGE_HEADER);
+    else
+        ret = write_extents(output);
+
+    fclose(output);
+
+    if (ret < 0) {
+        fprintf(stderr, "Unable to write '%s' -- aborting\n", outfile);
+        return 1;
+    }
+
+    if (mapfile != NULL) {
+        FILE *map = fopen(mapfile, "w");
+
+        if (map == NULL) {
+            fprintf(stderr, "Unable to open '%s' -- aborting\n", mapfile);
+            return 1;
+        }
+
+        write_map(map);
+        fclose(map);
+    }
+
+    /* Release resources */
+    for (i = 0; i < nmodules; ++i)
+        object_dispose(&(modules[i].object));
+
+    free(modules);
+    free(symbols);
+
+    return 0;
+}
+
+void display_help() {
+    printf("Usage: dcpu16ld [OPTIONS] OBJECT...\n"
+           "where OPTIONS is any of:\n"
+           "  -h, --help          Display this help\n"
+           "  -b, --bigendian     Generate big endian code "
+                                 "rather than little endian\n"
+           "  -B, --binary        Write a binary image, starting with a "
+                                 "header giving its\n"
+           "                      origin and length, instead of a "
+                                 "hexdump\n"
+           "  -r, --raw           Write a binary image without a header, "
+                                 "starting at\n"
+           "                      address 0\n"
+           "  -s, --start ADDR    Place the first object's relocatable "
+                                 "section at ADDR\n"
+           "                      instead of 0\n"
+           "  -o FILENAME         Write output to FILENAME instead of "
+                                 "\"out.hex\"\n"
+           "  -m, --map FILENAME  Write the address of every label to "
+                                 "FILENAME\n"
+           "\n"
+           "OBJECTs are written by \"dcpu16asm -c\".  Their relocatable "
+                                 "sections are placed\n"
+           "one after the other in the order given, so the first one "
+                                 "should start with\n"
+           "the code run first.\n");
+}
+
+/*
+ * Returns the address word 'addr' of module 'm' ends up at
+ */
+static uint16_t final_address(const module *m, uint16_t addr) {
+    return (addr < m->length) ? m->base + addr : addr;
+}
+
+/*
+ * Copies the sections of all modules to where they go, failing on those
+ * overlapping each other
+ */
+int place(module *modules, int n) {
+    int i, j;
+    uint32_t k;
+
+    for (i = 0; i < n; ++i) {
+        const dcpu16object *o = modules[i].object;
+
+        for (j = 0; j < o->nsections; ++j) {
+            const objsection *s = &(o->sections[j]);
+
+            for (k = 0; k < s->length; ++k) {
+                uint16_t addr = final_address(&(modules[i]), s->start + k);
+
+                if (owner[addr]) {
+                    fprintf(stderr, "'%s' and '%s' overlap at 0x%04X "
+                                    "-- aborting\n",
+                            modules[owner[addr] - 1].filename,
+                            modules[i].filename, addr);
+                    return -1;
+                }
+
+                ram[addr] = s->words[k];
+                owner[addr] = i + 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int by_name(const void *a, const void *b) {
+    const symbol *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+
+    return c ? c : (x->module - y->module);
+}
+
+static int has_name(const void *key, const void *s) {
+    return strcmp(key, ((const symbol*)s)->name);
+}
+
+/*
+ * Returns the symbol 'name' refers to, failing with NULL if it is not
+ * defined by exactly one module.  Every label is exported, so only those
+ * an object uses need to be unique.
+ */
+static symbol *find_symbol(const char *name, const char *filename) {
+    symbol *s;
+
+    if ((s = bsearch(name, symbols, nsymbols, sizeof(symbol),
+                     has_name)) == NULL) {
+        fprintf(stderr, "%s: Unresolved label '%s' -- aborting\n", filename,
+                name);
+        return NULL;
+    }
+
+    if (((s > symbols) && !strcmp(s[-1].name, name))
+            || ((s < symbols + nsymbols - 1) && !strcmp(s[1].name, name))) {
+        fprintf(stderr, "%s: Label '%s' is defined by more than one object "
+                        "-- aborting\n", filename, name);
+        return NULL;
+    }
+
+    return s;
+}
+
+/*
+ * Collects the labels defined by the modules and applies the relocations
+ */
+int resolve(module *modules, int n) {
+    int i, j, count = 0;
+
+    for (i = 0; i < n; ++i)
+        count += modules[i].object->nexports;
+
+    if ((symbols = malloc((count + 1) * sizeof(symbol))) == NULL) {
+        fprintf(stderr, "Out of memory -- aborting\n");
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i) {
+        const dcpu16object *o = modules[i].object;
+
+        for (j = 0; j < o->nexports; ++j) {
+            symbol *s = &(symbols[nsymbols++]);
+
+            s->name = o->exports[j].name;
+            s->module = i;
+            s->value = o->exports[j].relocatable
+                           ? modules[i].base + o->exports[j].value
+                           : o->exports[j].value;
+        }
+    }
+
+    qsort(symbols, nsymbols, sizeof(symbol), by_name);
+
+    for (i = 0; i < n; ++i) {
+        const module *m = &(modules[i]);
+        const dcpu16object *o = m->object;
+
+        for (j = 0; j < o->nimports; ++j)
+            if (find_symbol(o->imports[j], m->filename) == NULL)
+                return -1;
+
+        for (j = 0; j < o->nrelocs; ++j) {
+            const objreloc *r = &(o->relocs[j]);
+            uint16_t addr = final_address(m, r->addr);
+
+            if (owner[addr] != i + 1) {
+                fprintf(stderr, "%s: Relocation outside of the sections at "
+                                "0x%04X -- aborting\n", m->filename, r->addr);
+                return -1;
+            }
+
+            if (r->symbol == NULL) {
+                ram[addr] += m->base;
+            } else {
+                symbol *s = find_symbol(r->symbol, m->filename);
+
+                if (s == NULL)
+                    return -1;
+
+                ram[addr] = s->value;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Writes the words placed as a hexdump, leaving out the addresses between
+ * them
+ */
+int write_extents(FILE *f) {
+    static memextent extents[RAMSIZE / 2];
+    uint32_t addr = 0;
+    int n = 0;
+
+    while (addr < RAMSIZE) {
+        if (!owner[addr]) {
+            addr++;
+        } else {
+            extents[n].start = addr;
+
+            while ((addr < RAMSIZE) && owner[addr])
+                addr++;
+
+            extents[n++].end = addr;
+        }
+    }
+
+    return write_hexdump_extents(f, flag_be ? BIGENDIAN : LITTLEENDIAN, ram,
+                                 extents, n);
+}
+
+/*
+ * Writes ":LABEL ADDR" for every label, like the label part of the maps
+ * written by dcpu16asm but without the line the label is defined on
+ */
+void write_map(FILE *f) {
+    int i;
+
+    for (i = 0; i < nsymbols; ++i)
+        fprintf(f, ":%s %04X\n", symbols[i].name, symbols[i].value);
+}